@@ -1,39 +1,800 @@
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef EX2_ZLIB
+#include <zlib.h>
+#endif
+#ifdef EX2_ZSTD
+#include <zstd.h>
+#endif
 
+#ifndef MAX_CITIES
 #define MAX_CITIES (100000 + 1)          // One city for the airport
+#endif
+#ifndef MAX_ROUTES
 #define MAX_ROUTES (100000 + MAX_CITIES) // All routes, plus one route between each city and the airport.
+#endif
 
 #define DEFAULT_CAPACITY 128
 #define IMPOSSIBLE -1
 
+// The identifiers of the cities are as narrow as the largest graph we were compiled for allows, so the adjacency lists
+// take as little cache as possible. Graphs with more than 2^32 cities store their neighbours on 40 bits.
+#if MAX_CITIES <= UINT16_MAX
+typedef uint16_t city_t;
+typedef city_t city_slot_t;
+#elif MAX_CITIES <= UINT32_MAX
+typedef uint32_t city_t;
+typedef city_t city_slot_t;
+#elif MAX_CITIES <= (1LL << 40)
+#define CITY_PACKED_40
+typedef uint64_t city_t;
+typedef struct __attribute__((packed)) city_slot {
+  uint32_t low;
+  uint8_t high;
+} city_slot_t;
+#else
+typedef uint64_t city_t;
+typedef city_t city_slot_t;
+#endif
+
+/** Reads the city stored in an adjacency list slot. */
+static inline city_t city_load(const city_slot_t *slot) {
+#ifdef CITY_PACKED_40
+  return (city_t) slot->low | ((city_t) slot->high << 32);
+#else
+  return *slot;
+#endif
+}
+
+/** Writes a city in an adjacency list slot. */
+static inline void city_store(city_slot_t *slot, city_t city) {
+#ifdef CITY_PACKED_40
+  slot->low = (uint32_t) city;
+  slot->high = (uint8_t) (city >> 32);
+#else
+  *slot = city;
+#endif
+}
+
+// The offsets only need 64 bits when the adjacency lists may contain more than 2^32 entries.
+#if 2 * MAX_ROUTES <= UINT32_MAX
+typedef uint32_t offset_t;
+#else
+typedef uint64_t offset_t;
+#endif
+
+/** The structures whose memory is accounted separately. */
+typedef enum memory_category {
+  MEMORY_NEIGHBOURS,
+  MEMORY_OFFSETS,
+  MEMORY_SUCCINCT,
+  MEMORY_STAGING,
+  MEMORY_AIRPORTS,
+  MEMORY_QUEUES,
+  MEMORY_VISITED,
+  MEMORY_INDEXES,
+  MEMORY_BATCHES,
+  MEMORY_WEIGHTS,
+  MEMORY_LABELS,
+  MEMORY_CATEGORY_COUNT,
+} memory_category_t;
+
+const char *memory_category_names[MEMORY_CATEGORY_COUNT] = {
+    "neighbours", "offsets", "succinct", "staging", "airports", "queues", "visited", "indexes", "batches", "weights",
+    "labels",
+};
+
+#define MEMORY_PHASES 8
+
+/**
+ * The phases of the process, during which the page faults and the peak memory are accounted separately.
+ */
+typedef struct memory_phase {
+  const char *name;
+  long minor_faults;
+  long major_faults;
+  size_t peak;
+} memory_phase_t;
+
+/**
+ * The memory which is allocated for each structure of the process. The counters are updated atomically, so they can
+ * be shared by worker threads.
+ */
+typedef struct memory {
+  size_t current[MEMORY_CATEGORY_COUNT];
+  size_t peak[MEMORY_CATEGORY_COUNT];
+  size_t total;
+  size_t total_peak;
+
+  /** The phases which ended, and the phase which is running, whose faults are counted from its start. */
+  memory_phase_t phases[MEMORY_PHASES];
+  size_t phase_count;
+} memory_t;
+
+memory_t memory;
+
+/**
+ * The header of an accounted allocation, which remembers its size and category so it can be released without them.
+ * Its size keeps the allocations aligned for any type.
+ */
+typedef struct memory_header {
+  size_t bytes;
+  size_t category;
+} memory_header_t;
+
+/** Adds a number of bytes to a category, which may be negative when memory is released. */
+static void memory_account(memory_category_t category, ptrdiff_t bytes) {
+  size_t current = __atomic_add_fetch(&memory.current[category], bytes, __ATOMIC_RELAXED);
+  size_t total = __atomic_add_fetch(&memory.total, bytes, __ATOMIC_RELAXED);
+  // The peaks may miss a concurrent update, which is precise enough for a report.
+  if (current > memory.peak[category]) memory.peak[category] = current;
+  if (total > memory.total_peak) memory.total_peak = total;
+  if (memory.phase_count && total > memory.phases[memory.phase_count - 1].peak) {
+    memory.phases[memory.phase_count - 1].peak = total;
+  }
+}
+
+/**
+ * Allocates memory which is accounted to a category, and which must be released with memory_free.
+ * @param zero whether the memory is cleared.
+ * @return the memory, or NULL if it could not be allocated.
+ */
+void *memory_alloc(memory_category_t category, size_t bytes, bool zero) {
+  memory_header_t *header = (memory_header_t *) (zero ? calloc(1, sizeof(memory_header_t) + bytes)
+                                                      : malloc(sizeof(memory_header_t) + bytes));
+  if (!header) return NULL;
+  header->bytes = bytes;
+  header->category = category;
+  memory_account(category, bytes);
+  return header + 1;
+}
+
+/**
+ * Resizes memory which was allocated by memory_alloc, or allocates it if it is NULL.
+ * @return the memory, or NULL if it could not be allocated, in which case the original memory is left untouched.
+ */
+void *memory_realloc(memory_category_t category, void *data, size_t bytes) {
+  memory_header_t *header = data ? (memory_header_t *) data - 1 : NULL;
+  size_t previous = header ? header->bytes : 0;
+  header = (memory_header_t *) realloc(header, sizeof(memory_header_t) + bytes);
+  if (!header) return NULL;
+  header->bytes = bytes;
+  header->category = category;
+  memory_account(category, (ptrdiff_t) bytes - (ptrdiff_t) previous);
+  return header + 1;
+}
+
+/** Releases memory which was allocated by memory_alloc. May be NULL. */
+void memory_free(void *data) {
+  if (!data) return;
+  memory_header_t *header = (memory_header_t *) data - 1;
+  memory_account((memory_category_t) header->category, -(ptrdiff_t) header->bytes);
+  free(header);
+}
+
+/** Ends the running phase of the process, and starts a new one whose page faults are counted separately. */
+void memory_phase(const char *name) {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  if (memory.phase_count) {
+    memory_phase_t *running = &memory.phases[memory.phase_count - 1];
+    running->minor_faults = usage.ru_minflt - running->minor_faults;
+    running->major_faults = usage.ru_majflt - running->major_faults;
+  }
+  if (memory.phase_count == MEMORY_PHASES) return; // The later phases are not accounted separately.
+  memory_phase_t *phase = &memory.phases[memory.phase_count++];
+  phase->name = name;
+  phase->minor_faults = usage.ru_minflt;
+  phase->major_faults = usage.ru_majflt;
+  phase->peak = memory.total;
+}
+
+/** Prints the memory used by each structure, and the page faults of each phase. */
+void memory_report(FILE *out) {
+  for (size_t category = 0; category < MEMORY_CATEGORY_COUNT; category++) {
+    fprintf(out, "memory %s current %zu peak %zu\n", memory_category_names[category], memory.current[category],
+            memory.peak[category]);
+  }
+  fprintf(out, "memory total current %zu peak %zu\n", memory.total, memory.total_peak);
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  for (size_t i = 0; i < memory.phase_count; i++) {
+    const memory_phase_t *phase = &memory.phases[i];
+    bool running = i + 1 == memory.phase_count;
+    fprintf(out, "phase %s minor_faults %ld major_faults %ld peak %zu\n", phase->name,
+            running ? usage.ru_minflt - phase->minor_faults : phase->minor_faults,
+            running ? usage.ru_majflt - phase->major_faults : phase->major_faults, phase->peak);
+  }
+  fprintf(out, "rss_peak %ld\n", usage.ru_maxrss * 1024);
+}
+
+#define ELIAS_FANO_SAMPLE_RATE 256
+
+/**
+ * A monotone sequence of integers, stored with the Elias-Fano encoding. Each value is split into its low bits, which
+ * are stored verbatim, and its high bits, which are stored in unary as gaps in the upper bit vector. The position of
+ * every ELIAS_FANO_SAMPLE_RATE-th set bit is sampled, so any value can be accessed by scanning a bounded number of words.
+ */
+typedef struct elias_fano {
+
+  /** How many values are stored in the sequence. */
+  size_t count;
+
+  /** How many low bits of each value are stored verbatim. */
+  unsigned low_bits;
+
+  /** The low bits of the values, packed one after the other. */
+  uint64_t *lower;
+
+  /** The high bits of the values. The i-th value with high bits h sets the bit at position h + i. */
+  uint64_t *upper;
+
+  /** The number of words in the upper bit vector. */
+  size_t upper_words;
+
+  /** The position of the (i * ELIAS_FANO_SAMPLE_RATE)-th set bit of the upper bit vector. */
+  size_t *samples;
+} elias_fano_t;
+
+/**
+ * A cursor which reads consecutive values of an Elias-Fano sequence, without sampling the upper bits again.
+ */
+typedef struct elias_fano_iterator {
+
+  /** The index of the next value which will be read. */
+  size_t index;
+
+  /** The word of the upper bit vector which contains the next set bit. */
+  size_t word_index;
+
+  /** The bits of the current word which were not read yet. */
+  uint64_t word;
+} elias_fano_iterator_t;
+
+/** Returns how many low bits of each value are stored verbatim, for count values strictly smaller than universe. */
+static inline unsigned elias_fano_low_bits(size_t count, uint64_t universe) {
+  uint64_t ratio = count > 0 ? universe / count : 0;
+  return ratio > 1 ? 63 - __builtin_clzll(ratio) : 0;
+}
+
+/** Returns the number of bytes which a sequence of count values strictly smaller than universe will use. */
+size_t elias_fano_estimate(size_t count, uint64_t universe) {
+  unsigned low_bits = elias_fano_low_bits(count, universe);
+  size_t upper_words = (count + (universe >> low_bits) + 1) / 64 + 1;
+  return ((count * low_bits) / 64 + 2 + upper_words + 1) * sizeof(uint64_t) +
+      (count / ELIAS_FANO_SAMPLE_RATE + 1) * sizeof(size_t);
+}
+
+/**
+ * Prepares an empty Elias-Fano sequence, which will contain count values strictly smaller than universe.
+ * @param ef the sequence to initialize.
+ * @param count the number of values of the sequence.
+ * @param universe an exclusive upper bound on the values of the sequence.
+ * @return 0, or 1 if an error occurred.
+ */
+int elias_fano_init(elias_fano_t *ef, size_t count, uint64_t universe) {
+  unsigned low_bits = elias_fano_low_bits(count, universe);
+  ef->count = count;
+  ef->low_bits = low_bits;
+  ef->upper_words = (count + (universe >> low_bits) + 1) / 64 + 1;
+  ef->lower = (uint64_t *) memory_alloc(MEMORY_SUCCINCT, ((count * low_bits) / 64 + 2) * sizeof(uint64_t), true);
+  ef->upper = (uint64_t *) memory_alloc(MEMORY_SUCCINCT, (ef->upper_words + 1) * sizeof(uint64_t), true);
+  ef->samples = (size_t *) memory_alloc(MEMORY_SUCCINCT, (count / ELIAS_FANO_SAMPLE_RATE + 1) * sizeof(size_t), true);
+  if (!ef->lower || !ef->upper || !ef->samples) {
+    memory_free(ef->lower);
+    memory_free(ef->upper);
+    memory_free(ef->samples);
+    return 1;
+  }
+  return 0;
+}
+
+/**
+ * Stores the value at the provided index. Values may be set in any order, as long as the sequence ends up monotone.
+ */
+void elias_fano_set(elias_fano_t *ef, size_t index, uint64_t value) {
+  if (ef->low_bits > 0) {
+    uint64_t low = value & ((UINT64_C(1) << ef->low_bits) - 1);
+    size_t bit = index * ef->low_bits;
+    ef->lower[bit / 64] |= low << (bit % 64);
+    if (bit % 64 + ef->low_bits > 64) ef->lower[bit / 64 + 1] |= low >> (64 - bit % 64);
+  }
+  size_t position = (value >> ef->low_bits) + index;
+  ef->upper[position / 64] |= UINT64_C(1) << (position % 64);
+}
+
+/**
+ * Samples the positions of the set bits of the upper bit vector. Must be called once all the values were set.
+ */
+void elias_fano_seal(elias_fano_t *ef) {
+  size_t ones = 0;
+  for (size_t w = 0; w < ef->upper_words; w++) {
+    uint64_t word = ef->upper[w];
+    while (word) {
+      if (ones % ELIAS_FANO_SAMPLE_RATE == 0) ef->samples[ones / ELIAS_FANO_SAMPLE_RATE] = w * 64 + __builtin_ctzll(word);
+      word &= word - 1;
+      ones++;
+    }
+  }
+}
+
+/** Releases the memory used by an Elias-Fano sequence. */
+void elias_fano_free(elias_fano_t *ef) {
+  memory_free(ef->lower);
+  memory_free(ef->upper);
+  memory_free(ef->samples);
+  memset(ef, 0, sizeof(elias_fano_t));
+}
+
+/** Returns the number of bytes used by an Elias-Fano sequence. */
+size_t elias_fano_bytes(const elias_fano_t *ef) {
+  return ((ef->count * ef->low_bits) / 64 + 2 + ef->upper_words + 1) * sizeof(uint64_t) +
+      (ef->count / ELIAS_FANO_SAMPLE_RATE + 1) * sizeof(size_t);
+}
+
+/** Returns the low bits of the value at the provided index. */
+static inline uint64_t elias_fano_low(const elias_fano_t *ef, size_t index) {
+  if (ef->low_bits == 0) return 0;
+  size_t bit = index * ef->low_bits;
+  uint64_t low = ef->lower[bit / 64] >> (bit % 64);
+  if (bit % 64 + ef->low_bits > 64) low |= ef->lower[bit / 64 + 1] << (64 - bit % 64);
+  return low & ((UINT64_C(1) << ef->low_bits) - 1);
+}
+
+/**
+ * Positions an iterator on the value at the provided index. The set bit of the value is found from the closest
+ * sample, by counting the set bits of the following words.
+ */
+static inline void elias_fano_seek(const elias_fano_t *ef, size_t index, elias_fano_iterator_t *it) {
+  size_t sample = ef->samples[index / ELIAS_FANO_SAMPLE_RATE];
+  size_t w = sample / 64;
+  uint64_t word = ef->upper[w] & (~UINT64_C(0) << (sample % 64));
+  size_t skip = index % ELIAS_FANO_SAMPLE_RATE;
+  size_t ones = __builtin_popcountll(word);
+  while (ones <= skip) {
+    skip -= ones;
+    word = ef->upper[++w];
+    ones = __builtin_popcountll(word);
+  }
+  for (; skip > 0; skip--) word &= word - 1;
+  it->index = index;
+  it->word_index = w;
+  it->word = word;
+}
+
+/** Reads the next value of the sequence, and advances the iterator. */
+static inline uint64_t elias_fano_next(const elias_fano_t *ef, elias_fano_iterator_t *it) {
+  while (!it->word) it->word = ef->upper[++it->word_index];
+  size_t position = it->word_index * 64 + __builtin_ctzll(it->word);
+  it->word &= it->word - 1;
+  uint64_t high = position - it->index;
+  return (high << ef->low_bits) | elias_fano_low(ef, it->index++);
+}
+
+/** Returns the value at the provided index. */
+static inline uint64_t elias_fano_get(const elias_fano_t *ef, size_t index) {
+  elias_fano_iterator_t it;
+  elias_fano_seek(ef, index, &it);
+  return elias_fano_next(ef, &it);
+}
+
+/**
+ * Writes the low bits of a value at a bit position of an array of words, whose bits there must be clear.
+ * @param width the number of bits of the value, which must not have any higher bit set.
+ */
+static inline void bits_put(uint64_t *words, size_t position, uint64_t value, unsigned width) {
+  if (width == 0) return;
+  words[position / 64] |= value << (position % 64);
+  if (position % 64 + width > 64) words[position / 64 + 1] |= value >> (64 - position % 64);
+}
+
+/** Reads up to 64 bits at a bit position of an array of words, which has a word of padding after its last bit. */
+static inline uint64_t bits_get(const uint64_t *words, size_t position, unsigned width) {
+  if (width == 0) return 0;
+  uint64_t value = words[position / 64] >> (position % 64);
+  if (position % 64 + width > 64) value |= words[position / 64 + 1] << (64 - position % 64);
+  return width == 64 ? value : value & ((UINT64_C(1) << width) - 1);
+}
+
+/** Returns the number of bits of the Elias gamma code of a value. */
+static inline unsigned gamma_bits(uint64_t value) {
+  return 2 * (63 - __builtin_clzll(value + 1)) + 1;
+}
+
+/**
+ * Writes the Elias gamma code of a value, which is the number of bits of value + 1 after its highest one, in unary,
+ * followed by these bits.
+ * @return the bit position after the code.
+ */
+static inline size_t gamma_put(uint64_t *words, size_t position, uint64_t value) {
+  unsigned length = 63 - __builtin_clzll(value + 1);
+  bits_put(words, position + length, 1, 1);
+  bits_put(words, position + length + 1, (value + 1) & ((UINT64_C(1) << length) - 1), length);
+  return position + 2 * length + 1;
+}
+
+/** Reads an Elias gamma code written by gamma_put, and advances the bit position past it. */
+static inline uint64_t gamma_get(const uint64_t *words, size_t *position) {
+  unsigned length = __builtin_ctzll(bits_get(words, *position, 64));
+  uint64_t value = (UINT64_C(1) << length | bits_get(words, *position + length + 1, length)) - 1;
+  *position += 2 * length + 1;
+  return value;
+}
+
+/**
+ * A growable list of cities, used for the roads which are added to a graph, and to exchange the frontiers of a
+ * sharded search.
+ */
+typedef struct city_list {
+  size_t size;
+  size_t capacity;
+  uint64_t *items;
+} city_list_t;
+
 /**
- * A data structure which contains information about the current graph of cities. This data structure can then be
- * easily allocated on the stack, since it has a fixed size.
+ * Appends a city at the end of a list.
+ * @return 0, or 1 if an error occurred.
+ */
+int city_list_push(city_list_t *list, uint64_t city) {
+  if (list->size == list->capacity) {
+    size_t capacity = list->capacity ? list->capacity * 2 : DEFAULT_CAPACITY;
+    uint64_t *items = (uint64_t *) memory_realloc(MEMORY_QUEUES, list->items, capacity * sizeof(uint64_t));
+    if (!items) return 1;
+    list->items = items;
+    list->capacity = capacity;
+  }
+  list->items[list->size++] = city;
+  return 0;
+}
+
+/**
+ * Makes sure that a list can hold the provided number of cities.
+ * @return 0, or 1 if an error occurred.
+ */
+int city_list_reserve(city_list_t *list, size_t capacity) {
+  if (list->capacity >= capacity) return 0;
+  uint64_t *items = (uint64_t *) memory_realloc(MEMORY_QUEUES, list->items, capacity * sizeof(uint64_t));
+  if (!items) return 1;
+  list->items = items;
+  list->capacity = capacity;
+  return 0;
+}
+
+/** The ways in which the adjacency lists of a graph may be stored. */
+typedef enum graph_layout {
+  GRAPH_LAYOUT_CSR,
+  GRAPH_LAYOUT_SUCCINCT,
+} graph_layout_t;
+
+/**
+ * A data structure which contains information about the current graph of cities. The graph is either stored in a
+ * compressed sparse row layout, or in a succinct layout where the offsets are encoded with Elias-Fano, and each sorted
+ * adjacency list is encoded on its own. The degree of a city is not stored, since it is the difference between two
+ * consecutive offsets.
  */
 typedef struct graph {
 
   /** The number of cities of the graph. */
   size_t size;
 
-  /** The number of cities which are reachable from the provided city. */
-  int degrees[MAX_CITIES + 1];
+  /** How the adjacency lists are stored. */
+  graph_layout_t layout;
 
-  /** The offset in the neighbours adjacency list where the neighbours of the i-th city start. */
-  int start[MAX_CITIES + 1];
+  /** The offset in the neighbours adjacency list where the neighbours of the i-th city start. Has size + 1 entries. */
+  offset_t *start;
 
   /** The neighbours of the city at the provided index. Each edge goes in two directions. */
-  int neighbours[2 * MAX_ROUTES];
+  city_slot_t *neighbours;
+
+  /** The length of each entry of the neighbours, or NULL if the roads have no length. */
+  uint32_t *weights;
+
+  /** The neighbours of each city through the roads which were added after the graph was built, or NULL. */
+  city_list_t *extra;
+
+  /** The number of roads which were added after the graph was built. */
+  size_t extra_roads;
+
+  /** The offsets of the succinct layout. */
+  elias_fano_t succinct_start;
+
+  /** The bit position of the adjacency list of each city in the succinct layout. Has size + 1 values. */
+  elias_fano_t succinct_lists;
+
+  /** The adjacency lists of the succinct layout, which are encoded by succinct_list_put, and their number of words. */
+  uint64_t *succinct_bits;
+  size_t succinct_words;
+
+  /** The distance between each city and the airport hub, or NULL if it was not computed. */
+  int *hub_distances;
+
+  /** The connected component of each city, or NULL if they were not computed. */
+  city_t *components;
+
+  /** The number of cities of each connected component. */
+  city_t *component_sizes;
+
+  /** The number of connected components. */
+  size_t component_count;
+
+  /** The file mapping which holds the offsets and neighbours of the graph, or NULL if they were allocated. */
+  void *mapping;
+
+  /** The size of the file mapping. */
+  size_t mapping_bytes;
 } graph_t;
 
+/**
+ * A cursor over the neighbours of a city, which works for every layout of the graph.
+ */
+typedef struct neighbour_iterator {
+
+  /** The index of the next neighbour in the adjacency list. */
+  offset_t index;
+
+  /** The index past the last neighbour of the city. */
+  offset_t end;
+
+  /** The first neighbour of the city in the succinct layout, to which the other ones are relative, and whether it is
+   * the next one. */
+  uint64_t first;
+  bool at_first;
+
+  /** The high bits of the previous neighbour in the succinct layout, and the number of low bits of each neighbour. */
+  uint64_t high;
+  unsigned low_bits;
+
+  /** The bit positions of the low bits and of the high bits of the next neighbour in the succinct layout. */
+  size_t lower, upper;
+
+  /** The neighbours through added roads which are left, once the adjacency list is visited. */
+  const uint64_t *extra;
+  size_t extra_left;
+} neighbour_iterator_t;
+
+/** Returns the offset at which the adjacency list of the provided city starts. */
+static inline offset_t graph_start(const graph_t *graph, city_t city) {
+  if (graph->layout == GRAPH_LAYOUT_CSR) return graph->start[city];
+  return (offset_t) elias_fano_get(&graph->succinct_start, city);
+}
+
+/** Returns the number of cities which are reachable from the provided city. */
+static inline offset_t graph_degree(const graph_t *graph, city_t city) {
+  offset_t degree = graph_start(graph, city + 1) - graph_start(graph, city);
+  return graph->extra ? degree + graph->extra[city].size : degree;
+}
+
+/** Returns the difference between a city and another one, with the sign in the lowest bit. */
+static inline uint64_t zigzag(city_t city, city_t origin) {
+  return city >= origin ? 2 * (uint64_t) (city - origin) : 2 * (uint64_t) (origin - city) - 1;
+}
+
+/**
+ * Reads the header of the adjacency list of a city in the succinct layout. The first neighbour is stored as its
+ * difference with the city, and the other ones are stored relative to it, with the Elias-Fano encoding within the
+ * span of the list: first their low bits one after the other, and then the gaps between their high bits in unary.
+ * Since the cities which are close to each other tend to have close identifiers, most lists only take a few bits.
+ */
+static inline void succinct_list_open(const graph_t *graph, city_t city, neighbour_iterator_t *it) {
+  size_t position = elias_fano_get(&graph->succinct_lists, city);
+  uint64_t difference = gamma_get(graph->succinct_bits, &position);
+  it->first = difference & 1 ? city - (difference >> 1) - 1 : city + (difference >> 1);
+  it->at_first = true;
+  it->high = 0;
+  it->low_bits = 0;
+  offset_t degree = it->end - it->index;
+  if (degree > 1) {
+    uint64_t span = gamma_get(graph->succinct_bits, &position);
+    it->low_bits = elias_fano_low_bits(degree - 1, span + 1);
+  }
+  it->lower = position;
+  it->upper = position + (degree - 1) * it->low_bits;
+}
+
+/**
+ * Positions an iterator on the first neighbour of the provided city, in a graph with the provided layout. The searches
+ * which visit many cities pass a constant layout, so each of them is specialized for every layout once it is inlined.
+ */
+static inline __attribute__((always_inline)) void graph_neighbours_in(const graph_t *graph, graph_layout_t layout,
+                                                                      city_t city, neighbour_iterator_t *it) {
+  if (layout == GRAPH_LAYOUT_CSR) {
+    it->index = graph->start[city];
+    it->end = graph->start[city + 1];
+  } else {
+    elias_fano_iterator_t offsets;
+    elias_fano_seek(&graph->succinct_start, city, &offsets);
+    it->index = (offset_t) elias_fano_next(&graph->succinct_start, &offsets);
+    it->end = (offset_t) elias_fano_next(&graph->succinct_start, &offsets);
+    if (it->index < it->end) succinct_list_open(graph, city, it);
+  }
+  it->extra = graph->extra ? graph->extra[city].items : NULL;
+  it->extra_left = graph->extra ? graph->extra[city].size : 0;
+}
+
+/** Reads the next neighbour of a city in the succinct layout, which is not the last neighbour of its list. */
+static inline void succinct_list_next(const graph_t *graph, neighbour_iterator_t *it, city_t *neighbour) {
+  if (it->at_first) {
+    it->at_first = false;
+    *neighbour = (city_t) it->first;
+    return;
+  }
+  uint64_t window;
+  while (!(window = bits_get(graph->succinct_bits, it->upper, 64))) {
+    it->high += 64;
+    it->upper += 64;
+  }
+  unsigned zeros = __builtin_ctzll(window);
+  it->high += zeros;
+  it->upper += zeros + 1;
+  uint64_t low = bits_get(graph->succinct_bits, it->lower, it->low_bits);
+  it->lower += it->low_bits;
+  *neighbour = (city_t) (it->first + (it->high << it->low_bits | low));
+}
+
+/**
+ * Reads the next neighbour of a city, in a graph with the provided layout. The roads which were added to the graph
+ * are only visited once the adjacency list is, so the compressed sparse row layout is read by a plain loop.
+ * @return true if a neighbour was read, or false if all the neighbours were visited.
+ */
+static inline __attribute__((always_inline)) bool neighbour_iterator_next_in(const graph_t *graph,
+                                                                             graph_layout_t layout,
+                                                                             neighbour_iterator_t *it,
+                                                                             city_t *neighbour) {
+  if (__builtin_expect(it->index == it->end, 0)) {
+    if (it->extra_left == 0) return false;
+    it->extra_left--;
+    *neighbour = (city_t) *it->extra++;
+    return true;
+  }
+  if (layout == GRAPH_LAYOUT_CSR) {
+    *neighbour = city_load(&graph->neighbours[it->index]);
+  } else {
+    succinct_list_next(graph, it, neighbour);
+  }
+  it->index++;
+  return true;
+}
+
+/** Positions an iterator on the first neighbour of the provided city. */
+static inline void graph_neighbours(const graph_t *graph, city_t city, neighbour_iterator_t *it) {
+  graph_neighbours_in(graph, graph->layout, city, it);
+}
+
+/**
+ * Reads the next neighbour of a city.
+ * @return true if a neighbour was read, or false if all the neighbours were visited.
+ */
+static inline bool neighbour_iterator_next(const graph_t *graph, neighbour_iterator_t *it, city_t *neighbour) {
+  return neighbour_iterator_next_in(graph, graph->layout, it, neighbour);
+}
+
+/** Orders cities stored in adjacency list slots. */
+int compare_city_slots(const void *a, const void *b) {
+  city_t x = city_load((const city_slot_t *) a);
+  city_t y = city_load((const city_slot_t *) b);
+  return (x > y) - (x < y);
+}
+
+/** Returns the number of bits of the sorted adjacency list of a city in the succinct layout. */
+static size_t succinct_list_bits(city_t city, const city_slot_t *neighbours, size_t degree) {
+  city_t first = city_load(&neighbours[0]);
+  size_t bits = gamma_bits(zigzag(first, city));
+  if (degree == 1) return bits;
+  uint64_t span = city_load(&neighbours[degree - 1]) - first;
+  unsigned low_bits = elias_fano_low_bits(degree - 1, span + 1);
+  return bits + gamma_bits(span) + (degree - 1) * (low_bits + 1) + (span >> low_bits);
+}
+
+/**
+ * Writes the sorted adjacency list of a city in the succinct layout, as it is read by succinct_list_open.
+ * @return the bit position after the list.
+ */
+static size_t succinct_list_put(uint64_t *words, size_t position, city_t city, const city_slot_t *neighbours,
+                                size_t degree) {
+  city_t first = city_load(&neighbours[0]);
+  position = gamma_put(words, position, zigzag(first, city));
+  if (degree == 1) return position;
+  uint64_t span = city_load(&neighbours[degree - 1]) - first;
+  position = gamma_put(words, position, span);
+  unsigned low_bits = elias_fano_low_bits(degree - 1, span + 1);
+  size_t upper = position + (degree - 1) * low_bits;
+  uint64_t previous = 0;
+  for (size_t i = 1; i < degree; i++) {
+    uint64_t value = city_load(&neighbours[i]) - first;
+    bits_put(words, position, value & ((UINT64_C(1) << low_bits) - 1), low_bits);
+    position += low_bits;
+    upper += (value >> low_bits) - previous;
+    bits_put(words, upper++, 1, 1);
+    previous = value >> low_bits;
+  }
+  return upper;
+}
+
+/**
+ * Estimates how many bytes the succinct layout of a graph uses at most. A list takes at most about as many bits as the
+ * Elias-Fano encoding of its neighbours among all the cities, which is largest when all the cities have the same
+ * degree, and two gamma codes.
+ * @param cities the number of cities, including the hub.
+ * @param entries the number of entries of the adjacency lists.
+ */
+size_t succinct_estimate(size_t cities, size_t entries) {
+  unsigned low_bits = elias_fano_low_bits(entries / cities > 0 ? entries / cities : 1, cities);
+  unsigned city_bits = 64 - __builtin_clzll(cities);
+  uint64_t bits = (uint64_t) entries * (low_bits + 4) + (uint64_t) cities * 2 * (2 * city_bits + 1);
+  return elias_fano_estimate(cities + 1, (uint64_t) entries + 1) + elias_fano_estimate(cities + 1, bits + 1) +
+      (bits / 64 + 2) * sizeof(uint64_t);
+}
+
+/**
+ * Converts a graph in the compressed sparse row layout to the succinct layout. The adjacency lists are sorted, so they
+ * can be encoded, and the arrays of the compressed sparse row layout are released.
+ * @return 0, or 1 if an error occurred. The graph is left untouched on errors, but for the order of its lists.
+ */
+int graph_compress(graph_t *graph) {
+  if (graph->layout == GRAPH_LAYOUT_SUCCINCT) return 0;
+  size_t entries = graph->start[graph->size];
+  size_t bits = 0;
+  for (size_t city = 0; city < graph->size; city++) {
+    offset_t from = graph->start[city], until = graph->start[city + 1];
+    qsort(&graph->neighbours[from], until - from, sizeof(city_slot_t), compare_city_slots);
+    if (until > from) bits += succinct_list_bits(city, &graph->neighbours[from], until - from);
+  }
+  // The lists are followed by a padding word, since their bits are read by whole words.
+  graph->succinct_words = bits / 64 + 2;
+  graph->succinct_bits = (uint64_t *) memory_alloc(MEMORY_SUCCINCT, graph->succinct_words * sizeof(uint64_t), true);
+  if (!graph->succinct_bits) return 1;
+  if (elias_fano_init(&graph->succinct_start, graph->size + 1, (uint64_t) entries + 1)) {
+    memory_free(graph->succinct_bits);
+    graph->succinct_bits = NULL;
+    return 1;
+  }
+  if (elias_fano_init(&graph->succinct_lists, graph->size + 1, (uint64_t) bits + 1)) {
+    elias_fano_free(&graph->succinct_start);
+    memory_free(graph->succinct_bits);
+    graph->succinct_bits = NULL;
+    return 1;
+  }
+  size_t position = 0;
+  for (size_t city = 0; city < graph->size; city++) {
+    offset_t from = graph->start[city], until = graph->start[city + 1];
+    elias_fano_set(&graph->succinct_lists, city, position);
+    if (until > from) position = succinct_list_put(graph->succinct_bits, position, city, &graph->neighbours[from],
+                                                   until - from);
+  }
+  elias_fano_set(&graph->succinct_lists, graph->size, position);
+  for (size_t city = 0; city <= graph->size; city++) elias_fano_set(&graph->succinct_start, city, graph->start[city]);
+  elias_fano_seal(&graph->succinct_start);
+  elias_fano_seal(&graph->succinct_lists);
+  memory_free(graph->start);
+  memory_free(graph->neighbours);
+  graph->start = NULL;
+  graph->neighbours = NULL;
+  graph->layout = GRAPH_LAYOUT_SUCCINCT;
+  return 0;
+}
+
 /**
  * A data structure which represents at edge between two nodes, starting at from and ending at to.
  */
 typedef struct edge {
-  int from, to;
+  city_t from, to;
 } edge_t;
 
 /**
@@ -53,7 +814,7 @@ typedef struct circular_buffer {
   size_t size;
 
   /** A dynamically allocated array of the circular buffer elements. */
-  int *elements;
+  city_t *elements;
 } circular_buffer_t;
 
 /**
@@ -64,10 +825,10 @@ typedef struct circular_buffer {
 circular_buffer_t *make_circular_buffer(size_t capacity) {
   if (capacity == 0) return NULL;
   circular_buffer_t *ptr = (circular_buffer_t *) malloc(sizeof(circular_buffer_t));
-  int *elements = (int *) calloc(capacity, sizeof(int));
+  city_t *elements = (city_t *) memory_alloc(MEMORY_QUEUES, capacity * sizeof(city_t), true);
   if (!ptr || !elements) {
     free(ptr);
-    free(elements);
+    memory_free(elements);
     return NULL;
   }
   ptr->capacity = capacity;
@@ -84,18 +845,18 @@ circular_buffer_t *make_circular_buffer(size_t capacity) {
  * @param element the enqueued element.
  * @return 0, or 1 if an error occurred.
  */
-int circular_buffer_enqueue(circular_buffer_t *buffer, int element) {
+int circular_buffer_enqueue(circular_buffer_t *buffer, city_t element) {
   if (buffer->capacity == buffer->size) {
-    int *space = (int *) calloc(buffer->capacity * 2, sizeof(int));
+    city_t *space = (city_t *) memory_alloc(MEMORY_QUEUES, buffer->capacity * 2 * sizeof(city_t), true);
     if (!space) return 1; // We could not increase the buffer capacity.
 
     // TODO: A bit ugly, but essentially, we can simply duplicate the contents of the buffer rather than calculate good bounds.
-    memcpy(space, buffer->elements, buffer->capacity * sizeof(int));
-    memcpy(&space[buffer->capacity], buffer->elements, buffer->capacity * sizeof(int));
+    memcpy(space, buffer->elements, buffer->capacity * sizeof(city_t));
+    memcpy(&space[buffer->capacity], buffer->elements, buffer->capacity * sizeof(city_t));
 
     // Update the buffer structure.
     buffer->capacity *= 2;
-    free(buffer->elements);
+    memory_free(buffer->elements);
     buffer->elements = space;
   }
   size_t index = (buffer->start + buffer->size) % buffer->capacity;
@@ -110,152 +871,5928 @@ int circular_buffer_enqueue(circular_buffer_t *buffer, int element) {
  * @param buffer the buffer from which the element is removed.
  * @return the dequeued element.
  */
-int circular_buffer_dequeue(circular_buffer_t *buffer) {
+city_t circular_buffer_dequeue(circular_buffer_t *buffer) {
   if (buffer->size == 0) raise(SIGSEGV); // We do not expect callers to make this call. This is a bad violation.
   size_t index = buffer->start % buffer->capacity;
-  int item = buffer->elements[index];
+  city_t item = buffer->elements[index];
   buffer->size--;
   buffer->start = (buffer->start + 1) % buffer->capacity;
   return item;
 }
 
 /**
- * The graph in which the model will be stored.
+ * Releases a circular buffer, and the elements it contains.
+ * @param buffer the buffer to release. May be NULL.
  */
-graph_t graph;
-
-int solve(int from, int until) {
-  circular_buffer_t *queue = make_circular_buffer(DEFAULT_CAPACITY);
-  if (!queue) return IMPOSSIBLE;
-  int distance = 1;
-  bool visited[graph.size];
-  memset(visited, 0, graph.size * sizeof(bool));
+void free_circular_buffer(circular_buffer_t *buffer) {
+  if (!buffer) return;
+  memory_free(buffer->elements);
+  free(buffer);
+}
 
-  circular_buffer_enqueue(queue, from);
-  while (queue->size > 0) {
-    int head = circular_buffer_dequeue(queue);
-    if (head < 0) {
-      distance = -head;
-    } else if (head == until) {
-      return distance - 1;
-    } else {
-      if (graph.degrees[head] > 0) circular_buffer_enqueue(queue, -distance - 1);
-      for (int i = 0; i < graph.degrees[head]; i++) {
-        int city = graph.neighbours[graph.start[head] + i];
-        if (!visited[city]) {
-          circular_buffer_enqueue(queue, city);
-          visited[city] = true;
-        }
-      }
-    }
-  }
-  return IMPOSSIBLE;
+/** Returns the current time of a monotonic clock, in nanoseconds. */
+uint64_t now_ns() {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
 }
 
-#define BUFFER_SIZE (16 * 4096)
+/**
+ * A timeline of the phases of the process, written in the trace event format, which can be opened with Perfetto or
+ * chrome://tracing. The events are written as soon as they end, so the timeline only needs to be closed at exit.
+ */
+typedef struct tracer {
 
-// A buffer large enough to store any line we're given.
-char input_buffer[BUFFER_SIZE];
-char *input_ptr = input_buffer;
-char *input_ptr_end = input_buffer + BUFFER_SIZE - 1;
+  /** The file of the timeline, or NULL if no timeline is written. */
+  FILE *file;
+
+  /** The time at which the timeline starts. */
+  uint64_t origin;
+
+  /** The number of events which were written. */
+  size_t events;
+} tracer_t;
+
+/** The timeline of the process. */
+tracer_t tracer;
 
 /**
- * Initialize the scanner with some proper values.
+ * Starts writing a timeline to the provided file.
+ * @return 0, or 1 if an error occurred.
  */
-void scan_init() {
-  input_buffer[BUFFER_SIZE - 1] = '\0'; // Null-terminate the input buffer.
-  fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, stdin);
-  input_ptr = input_buffer;
+int tracer_open(const char *path) {
+  tracer.file = fopen(path, "w");
+  if (!tracer.file) return 1;
+  tracer.origin = now_ns();
+  tracer.events = 0;
+  fprintf(tracer.file, "{\"traceEvents\":[\n");
+  return 0;
 }
 
-/** Parses the next multi-digit integer. */
-int scan_int() {
-  int n = 0;
-  while (*input_ptr < '0' || *input_ptr > '9') {
-    ++input_ptr;
-    if (input_ptr == input_ptr_end) {
-      size_t read = fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, stdin);
-      if (read == 0) input_buffer[0] = '\0';
-      input_ptr = input_buffer;
-    }
-  }
-  while (*input_ptr >= '0' && *input_ptr <= '9') {
-    n *= 10;
-    n += *input_ptr - '0';
-    ++input_ptr;
-    if (input_ptr == input_ptr_end) {
-      size_t read = fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, stdin);
-      if (read == 0) input_buffer[0] = '\0';
-      input_ptr = input_buffer;
-    }
-  }
-  return n;
+/** Finishes the timeline, so it is valid JSON. */
+void tracer_close() {
+  if (!tracer.file) return;
+  fprintf(tracer.file, "\n]}\n");
+  fclose(tracer.file);
+  tracer.file = NULL;
 }
 
-int main() {
+/**
+ * Writes a span of the timeline.
+ * @param pid the process of the span, which groups the spans of a shard.
+ * @param tid the thread of the span, which groups the spans of a worker.
+ * @param args the JSON fields of the arguments of the span, without braces, or NULL.
+ */
+void tracer_span(const char *name, long pid, long tid, uint64_t started, uint64_t ended, const char *args) {
+  if (!tracer.file) return;
+  double ts = started > tracer.origin ? (started - tracer.origin) / 1e3 : 0;
+  flockfile(tracer.file); // The workers of a process share the timeline.
+  fprintf(tracer.file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%ld,", tracer.events++ ? ",\n" : "",
+          name, pid, tid);
+  fprintf(tracer.file, "\"ts\":%.3f,\"dur\":%.3f", ts, (ended - started) / 1e3);
+  if (args) fprintf(tracer.file, ",\"args\":{%s}", args);
+  fprintf(tracer.file, "}");
+  funlockfile(tracer.file);
+}
 
-  scan_init();
+/**
+ * Writes the span of a level of a breadth-first search, which started at the provided time.
+ * @return the time at which the level ended.
+ */
+uint64_t tracer_level(int level, uint64_t frontier, uint64_t started) {
+  char args[64];
+  snprintf(args, sizeof(args), "\"level\":%d,\"frontier\":%llu", level, (unsigned long long) frontier);
+  uint64_t ended = now_ns();
+  tracer_span("bfs level", getpid(), 0, started, ended, args);
+  return ended;
+}
 
-  int n = scan_int();
-  int m = scan_int();
-  int k = scan_int();
-  int s = scan_int();
-  int t = scan_int();
+/** Names a process or a thread of the timeline. */
+void tracer_name(const char *kind, long pid, long tid, const char *name) {
+  if (!tracer.file) return;
+  flockfile(tracer.file);
+  fprintf(tracer.file, "%s{\"name\":\"%s\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,", tracer.events++ ? ",\n" : "",
+          kind, pid, tid);
+  fprintf(tracer.file, "\"args\":{\"name\":\"%s\"}}", name);
+  funlockfile(tracer.file);
+}
 
-  int airports[k];
-  edge_t edges[m];
-  graph.size = n + 1;
+/**
+ * The shape of the traversal of a single query, which is used to diagnose the slowest queries.
+ */
+typedef struct bfs_trace {
 
-  for (int i = 0; i < k; i++) {
-    int city = scan_int();
-    airports[i] = city;
-    graph.degrees[0]++;
-    graph.degrees[city]++;
+  /** The number of levels which were expanded. */
+  size_t levels;
+
+  /** The number of levels which may be recorded before the frontiers array grows. */
+  size_t capacity;
+
+  /** The number of cities which were expanded at each level. */
+  uint64_t *frontiers;
+
+  /** The number of adjacency list entries which were scanned. */
+  uint64_t edges;
+
+  /** The level at which the airport hub was expanded, or -1 if it was not. */
+  int hub_level;
+} bfs_trace_t;
+
+/** Clears a trace, before a new query is run. */
+void bfs_trace_reset(bfs_trace_t *trace) {
+  trace->levels = 0;
+  trace->edges = 0;
+  trace->hub_level = -1;
+}
+
+/** Records the number of cities which were expanded at the next level. */
+void bfs_trace_level(bfs_trace_t *trace, uint64_t frontier) {
+  if (trace->levels == trace->capacity) {
+    size_t capacity = trace->capacity ? trace->capacity * 2 : 16;
+    uint64_t *frontiers = (uint64_t *) realloc(trace->frontiers, capacity * sizeof(uint64_t));
+    if (!frontiers) return; // The trace is only used for diagnostics, so the level is dropped.
+    trace->frontiers = frontiers;
+    trace->capacity = capacity;
+  }
+  trace->frontiers[trace->levels++] = frontier;
+}
+
+// Returned instead of a distance when a query ran out of budget, in which case only bounds on the distance are known.
+#define BOUNDED -2
+
+/**
+ * The resources which a query may use before it is cancelled. A limit of 0 means that the resource is not limited.
+ */
+typedef struct budget {
+
+  /** The time of the monotonic clock at which the query is cancelled, in nanoseconds. */
+  uint64_t deadline;
+
+  /** The number of adjacency list entries which may be scanned. */
+  uint64_t edges;
+} budget_t;
+
+/**
+ * The bounds on the distance between two cities which were proven when a query was cancelled.
+ */
+typedef struct bounds {
+
+  /** A lower bound on the distance. */
+  int lower;
+
+  /** An upper bound on the distance, or IMPOSSIBLE if none is known. */
+  int upper;
+} bounds_t;
+
+/**
+ * The memory which is needed to run queries on a graph. A single workspace may be reused by the queries of several
+ * graphs, since it grows to the size of the largest graph it was used with.
+ */
+typedef struct workspace {
+
+  /** The number of cities which may be marked in the visited array. */
+  size_t capacity;
+
+  /** Whether each city was already visited by the current query. */
+  bool *visited;
+
+  /** The queue of the cities which still have to be expanded. */
+  circular_buffer_t *queue;
+
+  /** The trace of the last query. */
+  bfs_trace_t trace;
+
+  /** The bounds on the distance of the last query, when it ran out of budget. */
+  bounds_t bounds;
+} workspace_t;
+
+/**
+ * Makes sure that a workspace can be used with a graph of the provided size.
+ * @return 0, or 1 if an error occurred.
+ */
+int workspace_reserve(workspace_t *workspace, size_t size) {
+  if (!workspace->queue) workspace->queue = make_circular_buffer(DEFAULT_CAPACITY);
+  if (!workspace->queue) return 1;
+  if (workspace->capacity >= size) return 0;
+  bool *visited = (bool *) memory_realloc(MEMORY_VISITED, workspace->visited, size * sizeof(bool));
+  if (!visited) return 1;
+  workspace->visited = visited;
+  workspace->capacity = size;
+  return 0;
+}
+
+/** Returns the number of bytes used by a workspace. */
+size_t workspace_bytes(const workspace_t *workspace) {
+  size_t bytes = workspace->capacity * sizeof(bool);
+  if (workspace->queue) bytes += workspace->queue->capacity * sizeof(city_t);
+  return bytes;
+}
+
+/** Releases the memory used by a workspace. */
+void workspace_free(workspace_t *workspace) {
+  memory_free(workspace->visited);
+  free_circular_buffer(workspace->queue);
+  free(workspace->trace.frontiers);
+  memset(workspace, 0, sizeof(workspace_t));
+}
+
+/** The search of solve_within, in a graph with the provided layout. */
+static inline __attribute__((always_inline)) int solve_within_in(const graph_t *graph, graph_layout_t layout,
+                                                                 workspace_t *workspace, city_t from, city_t until,
+                                                                 const budget_t *budget) {
+  if (workspace_reserve(workspace, graph->size)) return IMPOSSIBLE;
+  circular_buffer_t *queue = workspace->queue;
+  bool *visited = workspace->visited;
+  memset(visited, 0, graph->size * sizeof(bool));
+  queue->start = 0;
+  queue->size = 0;
+
+  bfs_trace_t *trace = &workspace->trace;
+  bfs_trace_reset(trace);
+
+  // Queries between components, or which involve the hub, are answered by the indexes of the graph.
+  if (graph->components && graph->components[from] != graph->components[until]) return IMPOSSIBLE;
+  if (graph->hub_distances && from != until && (from == 0 || until == 0)) {
+    return graph->hub_distances[from == 0 ? until : from];
+  }
+
+  int result = IMPOSSIBLE;
+  int distance = 0;
+  size_t remaining = 1; // How many cities of the current level are still in the queue.
+  size_t expanded = 0;
+
+  visited[from] = true;
+  circular_buffer_enqueue(queue, from);
+  bfs_trace_level(trace, 1);
+  uint64_t level_started = tracer.file ? now_ns() : 0;
+  while (queue->size > 0) {
+    city_t head = circular_buffer_dequeue(queue);
+    if (head == until) {
+      if (tracer.file) tracer_level(distance, trace->frontiers[trace->levels - 1], level_started);
+      result = distance;
+      break;
+    }
+    if (budget && ((budget->edges && trace->edges >= budget->edges) ||
+                   (budget->deadline && (++expanded & 0xFF) == 0 && now_ns() >= budget->deadline))) {
+      // The cities are expanded by increasing distance, so the target is at least as far as the current level.
+      workspace->bounds.lower = distance;
+      workspace->bounds.upper = visited[until] ? distance + 1 : IMPOSSIBLE;
+      result = BOUNDED;
+      break;
+    }
+    if (head == 0) trace->hub_level = distance;
+    neighbour_iterator_t it;
+    city_t city;
+    graph_neighbours_in(graph, layout, head, &it);
+    trace->edges += it.end - it.index + it.extra_left;
+    while (neighbour_iterator_next_in(graph, layout, &it, &city)) {
+      if (!visited[city]) {
+        circular_buffer_enqueue(queue, city);
+        visited[city] = true;
+      }
+    }
+    if (--remaining == 0) {
+      if (tracer.file) level_started = tracer_level(distance, trace->frontiers[trace->levels - 1], level_started);
+      remaining = queue->size;
+      distance++;
+      if (remaining > 0) bfs_trace_level(trace, remaining);
+    }
   }
-  for (int i = 0; i < m; i++) {
-    int a = scan_int();
-    int b = scan_int();
-    edges[i].from = a;
-    edges[i].to = b;
-    graph.degrees[a]++;
-    graph.degrees[b]++;
+  if (result == BOUNDED && graph->hub_distances) {
+    // Going through the hub is always possible when both cities can reach it, and the distances to the hub also
+    // bound the distance from below, by the triangle inequality.
+    int to_hub = graph->hub_distances[from], from_hub = graph->hub_distances[until];
+    if (to_hub != IMPOSSIBLE && from_hub != IMPOSSIBLE) {
+      int upper = to_hub + from_hub, lower = abs(to_hub - from_hub);
+      if (workspace->bounds.upper == IMPOSSIBLE || upper < workspace->bounds.upper) workspace->bounds.upper = upper;
+      if (lower > workspace->bounds.lower) workspace->bounds.lower = lower;
+    }
   }
+  if (result == BOUNDED && workspace->bounds.lower == workspace->bounds.upper) result = workspace->bounds.lower;
+  return result;
+}
 
-  // We can now compute the offsets.
-  int start = 0;
-  for (int i = 0; i < n + 2; i++) {
-    graph.start[i] = start;
-    start += graph.degrees[i];
-    graph.degrees[i] = 0; // Reset the degrees, so we can use them afterwards when we're adding items.
-  }
-
-  // Finally, add the proper normal edges.
-  for (int i = 0; i < m; i++) {
-    edge_t edge = edges[i];
-    size_t from_index = graph.start[edge.from] + graph.degrees[edge.from];
-    size_t to_index = graph.start[edge.to] + graph.degrees[edge.to];
-    graph.neighbours[from_index] = edge.to;
-    graph.neighbours[to_index] = edge.from;
-    graph.degrees[edge.from]++;
-    graph.degrees[edge.to]++;
-  }
-  // And the airports.
-  for (int i = 0; i < k; i++) {
-    int airport = airports[i];
-    size_t from_index = graph.start[0] + graph.degrees[0];
-    size_t to_index = graph.start[airport] + graph.degrees[airport];
-    graph.neighbours[from_index] = airport;
-    graph.neighbours[to_index] = 0;
-    graph.degrees[0]++;
-    graph.degrees[airport]++;
-  }
-
-  int result = solve(s, t);
-  if (result == IMPOSSIBLE) {
-    printf("Impossible\n");
+/**
+ * Runs a breadth-first search from the provided city, until the target city is found or the budget runs out. The
+ * levels of the search are delimited by counting how many cities of the current level are still in the queue. The
+ * shape of the search is recorded in the trace of the workspace. The search is specialized for the layout of the graph.
+ * @param graph the graph in which the search is run.
+ * @param workspace the memory used by the search.
+ * @param from the city at which the search starts.
+ * @param until the city which we're looking for.
+ * @param budget the resources the search may use, or NULL if they are not limited.
+ * @return the distance between both cities, IMPOSSIBLE if they're not connected, or BOUNDED if the budget ran out,
+ * in which case the bounds of the workspace are set.
+ */
+int solve_within(const graph_t *graph, workspace_t *workspace, city_t from, city_t until, const budget_t *budget) {
+  if (graph->layout == GRAPH_LAYOUT_CSR) {
+    return solve_within_in(graph, GRAPH_LAYOUT_CSR, workspace, from, until, budget);
+  }
+  return solve_within_in(graph, GRAPH_LAYOUT_SUCCINCT, workspace, from, until, budget);
+}
+
+/**
+ * Runs a breadth-first search from the provided city, until the target city is found.
+ * @return the distance between both cities, or IMPOSSIBLE if they're not connected.
+ */
+int solve(const graph_t *graph, workspace_t *workspace, city_t from, city_t until) {
+  return solve_within(graph, workspace, from, until, NULL);
+}
+
+/** The search of bfs_distances, in a graph with the provided layout. */
+static inline __attribute__((always_inline)) int bfs_distances_in(const graph_t *graph, graph_layout_t layout,
+                                                                  workspace_t *workspace, city_t from, int *distances) {
+  if (workspace_reserve(workspace, graph->size)) return 1;
+  circular_buffer_t *queue = workspace->queue;
+  queue->start = 0;
+  queue->size = 0;
+  bfs_trace_t *trace = &workspace->trace;
+  bfs_trace_reset(trace);
+  for (size_t city = 0; city < graph->size; city++) distances[city] = IMPOSSIBLE;
+  distances[from] = 0;
+  circular_buffer_enqueue(queue, from);
+  bfs_trace_level(trace, 1);
+  while (queue->size > 0) {
+    city_t head = circular_buffer_dequeue(queue);
+    if (head == 0) trace->hub_level = distances[head];
+    neighbour_iterator_t it;
+    city_t city;
+    graph_neighbours_in(graph, layout, head, &it);
+    trace->edges += it.end - it.index + it.extra_left;
+    while (neighbour_iterator_next_in(graph, layout, &it, &city)) {
+      if (distances[city] == IMPOSSIBLE) {
+        distances[city] = distances[head] + 1;
+        if (circular_buffer_enqueue(queue, city)) return 1;
+        // The cities are found by increasing distance, so a city is either on the last level or on a new one.
+        if ((size_t) distances[city] == trace->levels) {
+          bfs_trace_level(trace, 1);
+        } else {
+          trace->frontiers[trace->levels - 1]++;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+/**
+ * Computes the distance between a city and every city of a graph, with a full breadth-first search. The shape of the
+ * search is stored in the trace of the workspace, and the search is specialized for the layout of the graph.
+ * @param distances the distance to each city, or IMPOSSIBLE if it is not reachable.
+ * @return 0, or 1 if an error occurred.
+ */
+int bfs_distances(const graph_t *graph, workspace_t *workspace, city_t from, int *distances) {
+  if (graph->layout == GRAPH_LAYOUT_CSR) return bfs_distances_in(graph, GRAPH_LAYOUT_CSR, workspace, from, distances);
+  return bfs_distances_in(graph, GRAPH_LAYOUT_SUCCINCT, workspace, from, distances);
+}
+
+/**
+ * Computes the distance between each city and the airport hub, which bounds the distances of cancelled queries.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_index_hub(graph_t *graph, workspace_t *workspace) {
+  if (graph->hub_distances) return 0;
+  int *distances = (int *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(int), false);
+  if (!distances || bfs_distances(graph, workspace, 0, distances)) {
+    memory_free(distances);
+    return 1;
+  }
+  graph->hub_distances = distances;
+  return 0;
+}
+
+/**
+ * Labels the connected components of a graph, and counts their cities.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_index_components(graph_t *graph, workspace_t *workspace) {
+  if (graph->components) return 0;
+  if (workspace_reserve(workspace, graph->size)) return 1;
+  city_t *components = (city_t *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(city_t), false);
+  city_t *sizes = (city_t *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(city_t), false);
+  if (!components || !sizes) {
+    memory_free(components);
+    memory_free(sizes);
+    return 1;
+  }
+  circular_buffer_t *queue = workspace->queue;
+  bool *visited = workspace->visited;
+  memset(visited, 0, graph->size * sizeof(bool));
+  size_t count = 0;
+  for (size_t root = 0; root < graph->size; root++) {
+    if (visited[root]) continue;
+    queue->start = 0;
+    queue->size = 0;
+    visited[root] = true;
+    circular_buffer_enqueue(queue, root);
+    sizes[count] = 0;
+    while (queue->size > 0) {
+      city_t head = circular_buffer_dequeue(queue);
+      components[head] = count;
+      sizes[count]++;
+      neighbour_iterator_t it;
+      city_t city;
+      graph_neighbours(graph, head, &it);
+      while (neighbour_iterator_next(graph, &it, &city)) {
+        if (!visited[city]) {
+          circular_buffer_enqueue(queue, city);
+          visited[city] = true;
+        }
+      }
+    }
+    count++;
+  }
+  city_t *shrunk = (city_t *) memory_realloc(MEMORY_INDEXES, sizes, count * sizeof(city_t));
+  graph->components = components;
+  graph->component_sizes = shrunk ? shrunk : sizes;
+  graph->component_count = count;
+  return 0;
+}
+
+#define LABEL_INFINITE UINT32_MAX
+
+/** The distance between a city and a landmark, which is identified by its rank. */
+typedef struct label {
+  city_t landmark;
+  uint32_t distance;
+} label_t;
+
+/** The labels of a city, by increasing rank of their landmark. */
+typedef struct label_list {
+  uint32_t size;
+  uint32_t capacity;
+  label_t *items;
+} label_list_t;
+
+/**
+ * A 2-hop distance labelling of a graph, built by pruned landmark labelling (Akiba et al.): every city is a landmark,
+ * and the search from each landmark, by decreasing degree, stops at the cities whose distance to it is already given
+ * by the labels of the previous landmarks. The distance between two cities is then the smallest sum of their
+ * distances to a landmark which they share.
+ */
+typedef struct labels {
+  size_t size;
+
+  /** The city of each rank, and the rank of each city. */
+  city_t *order;
+  city_t *ranks;
+
+  /** The labels of each city. */
+  label_list_t *lists;
+
+  /** The number of labels of all the cities. */
+  size_t entries;
+
+  /** The number of labels at which the build gives up, or 0 if there is no limit. */
+  size_t max_entries;
+
+  /** The distances from the current landmark by rank, and the distances of the current search by city. */
+  uint32_t *landmark;
+  uint32_t *distances;
+  city_list_t queue;
+} labels_t;
+
+/** Adds a label to a city, or lowers its distance if the city already has a label for the landmark. */
+static int label_list_set(labels_t *labels, label_list_t *list, city_t landmark, uint32_t distance) {
+  uint32_t i = list->size;
+  while (i > 0 && list->items[i - 1].landmark > landmark) i--;
+  if (i > 0 && list->items[i - 1].landmark == landmark) {
+    if (distance < list->items[i - 1].distance) list->items[i - 1].distance = distance;
+    return 0;
+  }
+  if (labels->max_entries && labels->entries >= labels->max_entries) return 1;
+  if (list->size == list->capacity) {
+    uint32_t capacity = list->capacity ? list->capacity * 2 : 4;
+    label_t *items = (label_t *) memory_realloc(MEMORY_LABELS, list->items, capacity * sizeof(label_t));
+    if (!items) return 1;
+    list->items = items;
+    list->capacity = capacity;
+  }
+  memmove(&list->items[i + 1], &list->items[i], (list->size - i) * sizeof(label_t));
+  list->items[i] = (label_t) {landmark, distance};
+  list->size++;
+  labels->entries++;
+  return 0;
+}
+
+/** Returns the distance between the current landmark and a city through the labels, or LABEL_INFINITE. */
+static inline uint64_t labels_through(const labels_t *labels, city_t city) {
+  const label_list_t *list = &labels->lists[city];
+  uint64_t best = LABEL_INFINITE;
+  for (uint32_t i = 0; i < list->size; i++) {
+    uint32_t distance = labels->landmark[list->items[i].landmark];
+    if (distance != LABEL_INFINITE && distance + (uint64_t) list->items[i].distance < best) {
+      best = distance + (uint64_t) list->items[i].distance;
+    }
+  }
+  return best;
+}
+
+/**
+ * Runs a pruned search from a landmark, which starts at a city at a known distance from it. The cities whose distance
+ * to the landmark is not given by the labels yet get a label, and the search goes on from them.
+ * @return 0, or 1 if an error occurred.
+ */
+static int labels_search(labels_t *labels, const graph_t *graph, city_t rank, city_t start, uint32_t distance) {
+  const label_list_t *own = &labels->lists[labels->order[rank]];
+  for (uint32_t i = 0; i < own->size; i++) labels->landmark[own->items[i].landmark] = own->items[i].distance;
+  // The labels of the landmark may grow during the search, so they're cleared from a copy of their count.
+  uint32_t loaded = own->size;
+  city_list_t *queue = &labels->queue;
+  queue->size = 0;
+  int error = city_list_push(queue, start);
+  labels->distances[start] = distance;
+  for (size_t head = 0; head < queue->size && !error; head++) {
+    city_t city = queue->items[head];
+    uint32_t level = labels->distances[city];
+    if (labels_through(labels, city) <= level) continue;
+    error = label_list_set(labels, &labels->lists[city], rank, level);
+    neighbour_iterator_t it;
+    city_t neighbour;
+    graph_neighbours(graph, city, &it);
+    while (!error && neighbour_iterator_next(graph, &it, &neighbour)) {
+      if (labels->distances[neighbour] != LABEL_INFINITE) continue;
+      labels->distances[neighbour] = level + 1;
+      error = city_list_push(queue, neighbour);
+    }
+  }
+  for (size_t i = 0; i < queue->size; i++) labels->distances[queue->items[i]] = LABEL_INFINITE;
+  for (uint32_t i = 0; i < loaded; i++) labels->landmark[own->items[i].landmark] = LABEL_INFINITE;
+  return error;
+}
+
+/** Releases the labels of a graph. */
+void labels_free(labels_t *labels) {
+  for (size_t city = 0; labels->lists && city < labels->size; city++) memory_free(labels->lists[city].items);
+  memory_free(labels->lists);
+  memory_free(labels->order);
+  memory_free(labels->ranks);
+  memory_free(labels->landmark);
+  memory_free(labels->distances);
+  memory_free(labels->queue.items);
+  memset(labels, 0, sizeof(labels_t));
+}
+
+/** Returns the number of bytes used by the labels of a graph. */
+size_t labels_bytes(const labels_t *labels) {
+  if (!labels->lists) return 0;
+  return labels->size * (2 * sizeof(city_t) + sizeof(label_list_t) + 2 * sizeof(uint32_t)) +
+      labels->entries * sizeof(label_t) + labels->queue.capacity * sizeof(uint64_t);
+}
+
+/** Returns the number of bytes used at least by the labels of a graph, in which every city is its own landmark. */
+size_t labels_estimate(size_t cities) {
+  return cities * (2 * sizeof(city_t) + sizeof(label_list_t) + 2 * sizeof(uint32_t) + sizeof(label_t));
+}
+
+/** Orders cities by decreasing degree, which are stored with their degree in the high bits. */
+int compare_ranked_cities(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+  return (x < y) - (x > y);
+}
+
+/**
+ * Allocates the labels of a graph, which don't have any label yet.
+ * @return 0, or 1 if an error occurred.
+ */
+int labels_init(labels_t *labels, size_t size) {
+  memset(labels, 0, sizeof(labels_t));
+  labels->size = size;
+  labels->order = (city_t *) memory_alloc(MEMORY_LABELS, size * sizeof(city_t), false);
+  labels->ranks = (city_t *) memory_alloc(MEMORY_LABELS, size * sizeof(city_t), false);
+  labels->lists = (label_list_t *) memory_alloc(MEMORY_LABELS, size * sizeof(label_list_t), true);
+  labels->landmark = (uint32_t *) memory_alloc(MEMORY_LABELS, size * sizeof(uint32_t), false);
+  labels->distances = (uint32_t *) memory_alloc(MEMORY_LABELS, size * sizeof(uint32_t), false);
+  if (!labels->order || !labels->ranks || !labels->lists || !labels->landmark || !labels->distances) {
+    labels_free(labels);
+    return 1;
+  }
+  for (size_t city = 0; city < size; city++) {
+    labels->landmark[city] = LABEL_INFINITE;
+    labels->distances[city] = LABEL_INFINITE;
+  }
+  return 0;
+}
+
+/**
+ * Builds the labels of a graph, with one pruned search per city.
+ * @param max_entries the number of labels past which the build gives up, or 0 if there is no limit.
+ * @return 0, or 1 if an error occurred or if the labels have too many entries.
+ */
+int labels_build(labels_t *labels, const graph_t *graph, size_t max_entries) {
+  if (labels_init(labels, graph->size)) return 1;
+  labels->max_entries = max_entries;
+  uint64_t *ranked = (uint64_t *) memory_alloc(MEMORY_STAGING, graph->size * sizeof(uint64_t), false);
+  if (!ranked) {
+    labels_free(labels);
+    return 1;
+  }
+  // The cities of highest degree cover the most shortest paths, so their searches come first and prune the others.
+  // Their identifier is kept in the low bits, and complemented so ties are ranked by increasing identifier.
+  uint64_t mask = UINT64_C(0xFFFFFFFFFF);
+  for (size_t city = 0; city < graph->size; city++) {
+    uint64_t degree = graph_degree(graph, city);
+    ranked[city] = (degree > 0xFFFFFF ? 0xFFFFFF : degree) << 40 | (mask - city);
+  }
+  qsort(ranked, graph->size, sizeof(uint64_t), compare_ranked_cities);
+  for (size_t rank = 0; rank < graph->size; rank++) {
+    labels->order[rank] = mask - (ranked[rank] & mask);
+    labels->ranks[labels->order[rank]] = rank;
+  }
+  memory_free(ranked);
+  for (size_t rank = 0; rank < graph->size; rank++) {
+    if (labels_search(labels, graph, rank, labels->order[rank], 0)) {
+      labels_free(labels);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/** Returns the distance between two cities from their labels, or IMPOSSIBLE if they share no landmark. */
+int labels_query(const labels_t *labels, city_t from, city_t until) {
+  const label_list_t *a = &labels->lists[from], *b = &labels->lists[until];
+  uint64_t best = LABEL_INFINITE;
+  for (uint32_t i = 0, j = 0; i < a->size && j < b->size;) {
+    if (a->items[i].landmark < b->items[j].landmark) {
+      i++;
+    } else if (a->items[i].landmark > b->items[j].landmark) {
+      j++;
+    } else {
+      uint64_t distance = (uint64_t) a->items[i].distance + b->items[j].distance;
+      if (distance < best) best = distance;
+      i++;
+      j++;
+    }
+  }
+  return best == LABEL_INFINITE ? IMPOSSIBLE : (int) best;
+}
+
+/**
+ * Updates the labels of a graph after a road was added to it. The searches of the landmarks of each end of the road
+ * are resumed from its other end, which only visits the cities which got closer to them (Akiba et al., 2014). Labels
+ * whose distance got larger than the true one are kept, since they never make a distance shorter.
+ * @return 0, or 1 if an error occurred.
+ */
+int labels_add_road(labels_t *labels, const graph_t *graph, city_t from, city_t to) {
+  city_t ends[2] = {from, to};
+  int error = 0;
+  for (int side = 0; side < 2 && !error; side++) {
+    const label_list_t *list = &labels->lists[ends[side]];
+    // The searches change the labels of the end, so they're copied first.
+    label_t *copy = (label_t *) memory_alloc(MEMORY_STAGING, list->size * sizeof(label_t) + 1, false);
+    if (!copy) return 1;
+    uint32_t count = list->size;
+    memcpy(copy, list->items, count * sizeof(label_t));
+    for (uint32_t i = 0; i < count && !error; i++) {
+      error = labels_search(labels, graph, copy[i].landmark, ends[1 - side], copy[i].distance + 1);
+    }
+    memory_free(copy);
+  }
+  return error;
+}
+
+/**
+ * Estimates how many cities a search between two cities expands, without running it. The search explores a ball
+ * around its source, whose radius is estimated from the distances to the hub and which grows with the degrees of the
+ * cities, up to the size of the component of the source.
+ * @return the estimated number of expanded cities, or 0 if the query is answered by the indexes of the graph.
+ */
+uint64_t graph_estimate(const graph_t *graph, city_t from, city_t until) {
+  if (from == until) return 0;
+  if (graph->components && graph->components[from] != graph->components[until]) return 0;
+  if (graph->hub_distances && (from == 0 || until == 0)) return 0;
+  uint64_t size = graph->components ? graph->component_sizes[graph->components[from]] : graph->size;
+  uint64_t cost = graph_degree(graph, from) + 1;
+  if (graph->hub_distances && graph->hub_distances[from] != IMPOSSIBLE) {
+    int to_hub = graph->hub_distances[from], from_hub = graph->hub_distances[until];
+    int radius = (abs(to_hub - from_hub) + to_hub + from_hub) / 2;
+    uint64_t branching = graph->size ? graph_start(graph, graph->size) / graph->size : 0;
+    if (branching < 2) branching = 2;
+    for (int level = 1; level < radius && cost < size; level++) cost *= branching;
+  } else {
+    cost = size; // Without any bound on the distance, the whole component may be expanded.
+  }
+  return cost < size ? cost : size;
+}
+
+/** Releases the memory used by a graph, whatever its layout. */
+void graph_free(graph_t *graph) {
+  if (graph->mapping) {
+    munmap(graph->mapping, graph->mapping_bytes);
   } else {
-    printf("%d\n", result);
+    memory_free(graph->start);
+    memory_free(graph->neighbours);
+  }
+  memory_free(graph->weights);
+  for (size_t city = 0; graph->extra && city < graph->size; city++) memory_free(graph->extra[city].items);
+  memory_free(graph->extra);
+  elias_fano_free(&graph->succinct_start);
+  elias_fano_free(&graph->succinct_lists);
+  memory_free(graph->succinct_bits);
+  memory_free(graph->hub_distances);
+  memory_free(graph->components);
+  memory_free(graph->component_sizes);
+  memset(graph, 0, sizeof(graph_t));
+}
+
+/** Returns the number of bytes used by a graph. */
+size_t graph_bytes(const graph_t *graph) {
+  size_t bytes = graph->hub_distances ? graph->size * sizeof(int) : 0;
+  if (graph->components) bytes += (graph->size + graph->component_count) * sizeof(city_t);
+  if (graph->weights) bytes += graph->start[graph->size] * sizeof(uint32_t);
+  if (graph->extra) bytes += graph->size * sizeof(city_list_t) + 2 * graph->extra_roads * sizeof(uint64_t);
+  if (graph->layout == GRAPH_LAYOUT_SUCCINCT) {
+    return bytes + elias_fano_bytes(&graph->succinct_start) + elias_fano_bytes(&graph->succinct_lists) +
+        graph->succinct_words * sizeof(uint64_t);
+  }
+  return bytes + (graph->size + 1) * sizeof(offset_t) + graph->start[graph->size] * sizeof(city_slot_t);
+}
+
+/**
+ * Adds a road between two cities of a built graph, in lists next to its adjacency lists. The indexes of the graph are
+ * released, since they may not hold anymore.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_add_road(graph_t *graph, city_t from, city_t to) {
+  if (!graph->extra) {
+    graph->extra = (city_list_t *) memory_alloc(MEMORY_NEIGHBOURS, graph->size * sizeof(city_list_t), true);
+    if (!graph->extra) return 1;
+  }
+  if (city_list_push(&graph->extra[from], to)) return 1;
+  if (city_list_push(&graph->extra[to], from)) {
+    graph->extra[from].size--;
+    return 1;
+  }
+  graph->extra_roads++;
+  memory_free(graph->hub_distances);
+  memory_free(graph->components);
+  memory_free(graph->component_sizes);
+  graph->hub_distances = NULL;
+  graph->components = NULL;
+  graph->component_sizes = NULL;
+  graph->component_count = 0;
+  return 0;
+}
+
+#define BUFFER_SIZE (16 * 4096)
+
+// A buffer large enough to store any line we're given.
+char input_buffer[BUFFER_SIZE];
+char *input_ptr = input_buffer;
+char *input_ptr_end = input_buffer + BUFFER_SIZE - 1;
+
+// The stream from which the scanner reads its text. It is the standard input, unless the input is compressed.
+FILE *input_file;
+
+/** The formats of the input, which are detected from their first bytes. */
+typedef enum input_format {
+  INPUT_TEXT,
+  INPUT_GZIP,
+  INPUT_ZSTD,
+} input_format_t;
+
+const char *input_format_names[] = {"text", "gzip", "zstd"};
+
+/** Detects the format of the input from its first bytes. */
+input_format_t input_detect(const unsigned char *bytes, size_t size) {
+  if (size >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B) return INPUT_GZIP;
+  if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD) return INPUT_ZSTD;
+  return INPUT_TEXT;
+}
+
+#define DECODER_CHUNK (1 << 16)
+
+/**
+ * A thread which decompresses the input into a pipe, from which the scanner reads the text. Parsing the text and
+ * decoding the next chunks overlap, and the decompressed input is never written to disk.
+ */
+typedef struct decoder {
+  input_format_t format;
+  FILE *source;
+
+  /** The compressed bytes which were read to detect the format, and which are decoded first. */
+  unsigned char *prefix;
+  size_t prefix_size;
+
+  /** The write end of the pipe. */
+  int sink;
+  pthread_t thread;
+  bool running;
+
+  /** Whether the input could not be decoded. */
+  int error;
+} decoder_t;
+
+decoder_t decoder;
+
+/**
+ * Writes a decoded chunk to the pipe.
+ * @return 0, or 1 if the scanner stopped reading.
+ */
+static int decoder_write(decoder_t *decoder, const unsigned char *data, size_t size) {
+  while (size > 0) {
+    ssize_t count = write(decoder->sink, data, size);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) return 1;
+    data += count;
+    size -= count;
+  }
+  return 0;
+}
+
+/**
+ * Reads the next compressed chunk, starting with the bytes which were read to detect the format.
+ * @return the number of bytes which were read, or 0 at the end of the input.
+ */
+static size_t decoder_read(decoder_t *decoder, unsigned char *chunk) {
+  if (decoder->prefix_size > 0) {
+    size_t size = decoder->prefix_size;
+    memcpy(chunk, decoder->prefix, size);
+    decoder->prefix_size = 0;
+    return size;
+  }
+  return fread(chunk, 1, DECODER_CHUNK, decoder->source);
+}
+
+#ifdef EX2_ZLIB
+/**
+ * Decodes a gzip input, which may be made of several members like the outputs of pigz or bgzip.
+ * @return 0, or 1 if the input is not valid.
+ */
+static int decoder_gzip(decoder_t *decoder, unsigned char *chunk, unsigned char *text) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  if (inflateInit2(&stream, 15 + 32) != Z_OK) return 1; // 32 detects the gzip header.
+  int status = Z_OK;
+  bool stopped = false;
+  while (!stopped && (stream.avail_in = decoder_read(decoder, chunk)) > 0) {
+    stream.next_in = chunk;
+    while (stream.avail_in > 0 && !stopped) {
+      stream.next_out = text;
+      stream.avail_out = DECODER_CHUNK;
+      status = inflate(&stream, Z_NO_FLUSH);
+      if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) break;
+      stopped = decoder_write(decoder, text, DECODER_CHUNK - stream.avail_out);
+      if (status == Z_STREAM_END) inflateReset(&stream); // The next member starts right after this one.
+    }
+    if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR) break;
+  }
+  inflateEnd(&stream);
+  return !stopped && status != Z_STREAM_END;
+}
+#endif
+
+#ifdef EX2_ZSTD
+/**
+ * Decodes a zstd input, which may be made of several frames.
+ * @return 0, or 1 if the input is not valid.
+ */
+static int decoder_zstd(decoder_t *decoder, unsigned char *chunk, unsigned char *text) {
+  ZSTD_DStream *stream = ZSTD_createDStream();
+  if (!stream) return 1;
+  ZSTD_initDStream(stream);
+  size_t hint = 0;
+  bool stopped = false, failed = false;
+  ZSTD_inBuffer in = {chunk, 0, 0};
+  while (!stopped && !failed && (in.size = decoder_read(decoder, chunk)) > 0) {
+    in.pos = 0;
+    while (in.pos < in.size && !stopped && !failed) {
+      ZSTD_outBuffer out = {text, DECODER_CHUNK, 0};
+      hint = ZSTD_decompressStream(stream, &out, &in);
+      failed = ZSTD_isError(hint);
+      if (!failed) stopped = decoder_write(decoder, text, out.pos);
+    }
+  }
+  ZSTD_freeDStream(stream);
+  return !stopped && (failed || hint != 0); // A hint of 0 means that the last frame is complete.
+}
+#endif
+
+/** Runs the decoder thread, which closes the pipe once the input is decoded. */
+static void *decoder_run(void *argument) {
+  decoder_t *decoder = (decoder_t *) argument;
+  // A scanner which stops reading closes the pipe, which must fail the writes rather than kill the process.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  unsigned char *chunk = (unsigned char *) malloc(DECODER_CHUNK);
+  unsigned char *text = (unsigned char *) malloc(DECODER_CHUNK);
+  decoder->error = !chunk || !text;
+#ifdef EX2_ZLIB
+  if (!decoder->error && decoder->format == INPUT_GZIP) decoder->error = decoder_gzip(decoder, chunk, text);
+#endif
+#ifdef EX2_ZSTD
+  if (!decoder->error && decoder->format == INPUT_ZSTD) decoder->error = decoder_zstd(decoder, chunk, text);
+#endif
+  free(chunk);
+  free(text);
+  close(decoder->sink);
+  return NULL;
+}
+
+/**
+ * Starts decoding a compressed input in a thread.
+ * @param prefix the first bytes of the input, which were already read.
+ * @return the stream of the decoded text, or NULL if the format is not supported by this build or an error occurred.
+ */
+FILE *decoder_start(decoder_t *decoder, input_format_t format, FILE *source, const char *prefix, size_t size) {
+#ifndef EX2_ZLIB
+  if (format == INPUT_GZIP) return NULL;
+#endif
+#ifndef EX2_ZSTD
+  if (format == INPUT_ZSTD) return NULL;
+#endif
+  int fds[2];
+  memset(decoder, 0, sizeof(decoder_t));
+  decoder->format = format;
+  decoder->source = source;
+  decoder->prefix = (unsigned char *) malloc(size + 1);
+  if (!decoder->prefix || pipe(fds)) {
+    free(decoder->prefix);
+    return NULL;
+  }
+  memcpy(decoder->prefix, prefix, size);
+  decoder->prefix_size = size;
+  decoder->sink = fds[1];
+  FILE *text = fdopen(fds[0], "r");
+  if (!text || pthread_create(&decoder->thread, NULL, decoder_run, decoder)) {
+    if (text) fclose(text);
+    else close(fds[0]);
+    close(fds[1]);
+    free(decoder->prefix);
+    return NULL;
   }
+  decoder->running = true;
+  return text;
+}
 
+/**
+ * Initialize the scanner with some proper values. A compressed input is decoded by a thread, which feeds the buffer of
+ * the scanner through a pipe.
+ * @return 0, or 1 if the input is compressed in a format which this build can't decode.
+ */
+int scan_init() {
+  input_file = stdin;
+  input_buffer[BUFFER_SIZE - 1] = '\0'; // Null-terminate the input buffer.
+  size_t read = fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, stdin);
+  input_format_t format = input_detect((const unsigned char *) input_buffer, read);
+  if (format != INPUT_TEXT) {
+    input_file = decoder_start(&decoder, format, stdin, input_buffer, read);
+    if (!input_file) return 1;
+    read = fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, input_file);
+    memset(input_buffer + read, 0, BUFFER_SIZE - 1 - read);
+  }
+  input_ptr = input_buffer;
   return 0;
 }
+
+/**
+ * Stops the scanner, once the whole graph was read.
+ * @return 0, or 1 if the compressed input could not be decoded.
+ */
+int scan_close() {
+  if (!decoder.running) return 0;
+  fclose(input_file); // The decoder stops once it can't write to the pipe anymore.
+  input_file = stdin;
+  pthread_join(decoder.thread, NULL);
+  free(decoder.prefix);
+  decoder.running = false;
+  return decoder.error;
+}
+
+/** A hash of the numbers of an input, which identifies its graph whatever its formatting or compression. */
+typedef struct fingerprint {
+  uint64_t hash;
+} fingerprint_t;
+
+/** Adds a number to a fingerprint, with the finalizer of splitmix64 so every bit of the number affects the hash. */
+static inline void fingerprint_add(fingerprint_t *fingerprint, uint64_t value) {
+  uint64_t z = fingerprint->hash ^ (value + UINT64_C(0x9E3779B97F4A7C15));
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  fingerprint->hash = z ^ (z >> 31);
+}
+
+// The fingerprint to which the scanner adds the numbers it parses, or NULL.
+fingerprint_t *input_fingerprint;
+
+/** Parses the next multi-digit integer. */
+size_t scan_int() {
+  size_t n = 0;
+  while (*input_ptr < '0' || *input_ptr > '9') {
+    ++input_ptr;
+    if (input_ptr == input_ptr_end) {
+      size_t read = fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, input_file);
+      if (read == 0) input_buffer[0] = '\0';
+      input_ptr = input_buffer;
+    }
+  }
+  while (*input_ptr >= '0' && *input_ptr <= '9') {
+    n *= 10;
+    n += *input_ptr - '0';
+    ++input_ptr;
+    if (input_ptr == input_ptr_end) {
+      size_t read = fread(input_buffer, sizeof(char), BUFFER_SIZE - 1, input_file);
+      if (read == 0) input_buffer[0] = '\0';
+      input_ptr = input_buffer;
+    }
+  }
+  if (input_fingerprint) fingerprint_add(input_fingerprint, n);
+  return n;
+}
+
+/**
+ * The contents of a text input: the header, and the airports and routes which follow it.
+ */
+typedef struct input {
+
+  /** The number of cities, without the airport hub. */
+  size_t cities;
+
+  /** The number of roads between two cities. */
+  size_t roads;
+
+  /** The number of cities which have an airport. */
+  size_t airports_count;
+
+  /** The cities between which the distance is asked. */
+  city_t from, until;
+
+  /** The cities which have an airport. */
+  city_t *airports;
+
+  /** The roads between two cities. */
+  edge_t *edges;
+
+  /** Whether the graph is built with the lengths of its roads and the cost of its flights. */
+  bool weighted;
+
+  /** Whether each road of the input is followed by its length. */
+  bool road_lengths;
+
+  /** The length of each road, or NULL if they all have length 1. */
+  uint32_t *lengths;
+
+  /** The cost of a flight between two airports of a weighted graph. Half of it is paid to get to the hub. */
+  uint32_t flight_cost;
+} input_t;
+
+/**
+ * Reads the header of the input from the scanner.
+ * @return 0, or 1 if the graph is too large for this build.
+ */
+int input_read_header(input_t *input) {
+  input->cities = scan_int();
+  input->roads = scan_int();
+  input->airports_count = scan_int();
+  input->from = scan_int();
+  input->until = scan_int();
+  return input->cities + 1 > MAX_CITIES || input->roads + input->airports_count > MAX_ROUTES;
+}
+
+/**
+ * Reads the airports and the routes of the input from the scanner, once the header was read.
+ * @return 0, or 1 if an error occurred.
+ */
+int input_read_lists(input_t *input) {
+  input->airports = (city_t *) memory_alloc(MEMORY_AIRPORTS, input->airports_count * sizeof(city_t), false);
+  input->edges = (edge_t *) memory_alloc(MEMORY_STAGING, input->roads * sizeof(edge_t), false);
+  if ((input->airports_count && !input->airports) || (input->roads && !input->edges)) return 1;
+  if (input->road_lengths) {
+    input->lengths = (uint32_t *) memory_alloc(MEMORY_STAGING, input->roads * sizeof(uint32_t), false);
+    if (input->roads && !input->lengths) return 1;
+  }
+  for (size_t i = 0; i < input->airports_count; i++) {
+    input->airports[i] = scan_int();
+  }
+  for (size_t i = 0; i < input->roads; i++) {
+    input->edges[i].from = scan_int();
+    input->edges[i].to = scan_int();
+    if (input->road_lengths) input->lengths[i] = scan_int();
+  }
+  return 0;
+}
+
+/** Releases the airports and routes of an input. */
+void input_free(input_t *input) {
+  memory_free(input->airports);
+  memory_free(input->edges);
+  memory_free(input->lengths);
+  input->airports = NULL;
+  input->edges = NULL;
+  input->lengths = NULL;
+}
+
+/**
+ * Builds the compressed sparse row layout of a graph from its input. The airports are linked to the hub, which is the
+ * city 0.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_build(graph_t *graph, const input_t *input) {
+  size_t m = input->roads, k = input->airports_count;
+  memset(graph, 0, sizeof(graph_t));
+  graph->size = input->cities + 1;
+  graph->layout = GRAPH_LAYOUT_CSR;
+  graph->start = (offset_t *) memory_alloc(MEMORY_OFFSETS, (graph->size + 1) * sizeof(offset_t), true);
+  graph->neighbours = (city_slot_t *) memory_alloc(MEMORY_NEIGHBOURS, 2 * (m + k) * sizeof(city_slot_t), false);
+  if (input->weighted) {
+    graph->weights = (uint32_t *) memory_alloc(MEMORY_WEIGHTS, 2 * (m + k) * sizeof(uint32_t), false);
+  }
+  if (!graph->start || (m + k && (!graph->neighbours || (input->weighted && !graph->weights)))) {
+    graph_free(graph);
+    return 1;
+  }
+
+  // The degree of each city is first counted in the offset of the following city.
+  for (size_t i = 0; i < k; i++) {
+    graph->start[1]++;
+    graph->start[input->airports[i] + 1]++;
+  }
+  for (size_t i = 0; i < m; i++) {
+    graph->start[input->edges[i].from + 1]++;
+    graph->start[input->edges[i].to + 1]++;
+  }
+
+  // We can now compute the offsets.
+  for (size_t i = 1; i <= graph->size; i++) {
+    graph->start[i] += graph->start[i - 1];
+  }
+
+  // Finally, add the proper normal edges. The offset of each city is used as an insertion cursor, so it ends up at the
+  // offset of the following city.
+  for (size_t i = 0; i < m; i++) {
+    edge_t edge = input->edges[i];
+    if (graph->weights) {
+      uint32_t length = input->lengths ? input->lengths[i] : 1;
+      graph->weights[graph->start[edge.from]] = length;
+      graph->weights[graph->start[edge.to]] = length;
+    }
+    city_store(&graph->neighbours[graph->start[edge.from]++], edge.to);
+    city_store(&graph->neighbours[graph->start[edge.to]++], edge.from);
+  }
+  // And the airports. A flight costs half of its price from the hub, and the other half to it.
+  for (size_t i = 0; i < k; i++) {
+    city_t airport = input->airports[i];
+    if (graph->weights) {
+      graph->weights[graph->start[0]] = input->flight_cost / 2;
+      graph->weights[graph->start[airport]] = input->flight_cost - input->flight_cost / 2;
+    }
+    city_store(&graph->neighbours[graph->start[0]++], airport);
+    city_store(&graph->neighbours[graph->start[airport]++], 0);
+  }
+
+  // Shift the cursors back, so each offset points at the start of its adjacency list again.
+  for (size_t i = graph->size; i > 0; i--) {
+    graph->start[i] = graph->start[i - 1];
+  }
+  graph->start[0] = 0;
+  return 0;
+}
+
+// Returned by the edge-centric search when the target is further than the number of sweeps it may run.
+#define SWEEPS_EXCEEDED -3
+
+// The largest estimated diameter for which a single query sweeps the roads rather than building the adjacency lists.
+#define EDGE_SWEEPS_MAX 12
+
+/**
+ * Estimates the diameter of a graph from its size alone, as the number of levels after which a search which expands
+ * the average degree at each level covers all the cities.
+ */
+size_t estimate_diameter(size_t cities, size_t roads, size_t airports) {
+  double degree = cities ? 2.0 * (roads + airports) / cities : 0;
+  if (degree <= 1.0) return cities;
+  size_t diameter = 1;
+  for (double covered = degree; covered < cities && diameter < cities; covered *= degree) diameter++;
+  return diameter;
+}
+
+/**
+ * Runs a breadth-first search by sweeping over all the roads and airports once per level, rather than over adjacency
+ * lists. Each sweep reads the input sequentially, so a few sweeps cost less than building the adjacency lists, whose
+ * scatter accesses memory at random.
+ * @param max_sweeps the number of levels after which the search gives up.
+ * @return the distance between both cities, IMPOSSIBLE if they're not connected, or SWEEPS_EXCEEDED.
+ */
+int solve_edges(const input_t *input, workspace_t *workspace, city_t from, city_t until, size_t max_sweeps) {
+  size_t size = input->cities + 1;
+  int *levels = (int *) memory_alloc(MEMORY_VISITED, size * sizeof(int), false);
+  if (!levels) return SWEEPS_EXCEEDED;
+  for (size_t city = 0; city < size; city++) levels[city] = IMPOSSIBLE;
+  bfs_trace_t *trace = &workspace->trace;
+  bfs_trace_reset(trace);
+
+  levels[from] = 0;
+  bfs_trace_level(trace, 1);
+  int result = from == until ? 0 : IMPOSSIBLE;
+  uint64_t level_started = tracer.file ? now_ns() : 0;
+  for (int level = 0; result == IMPOSSIBLE; level++) {
+    if ((size_t) level == max_sweeps) {
+      result = SWEEPS_EXCEEDED;
+      break;
+    }
+    uint64_t discovered = 0;
+    for (size_t i = 0; i < input->roads; i++) {
+      city_t a = input->edges[i].from, b = input->edges[i].to;
+      if (levels[a] == level && levels[b] == IMPOSSIBLE) {
+        levels[b] = level + 1;
+        discovered++;
+      } else if (levels[b] == level && levels[a] == IMPOSSIBLE) {
+        levels[a] = level + 1;
+        discovered++;
+      }
+    }
+    for (size_t i = 0; i < input->airports_count; i++) {
+      city_t airport = input->airports[i];
+      if (levels[0] == level && levels[airport] == IMPOSSIBLE) {
+        levels[airport] = level + 1;
+        discovered++;
+      } else if (levels[airport] == level && levels[0] == IMPOSSIBLE) {
+        levels[0] = level + 1;
+        discovered++;
+      }
+    }
+    trace->edges += 2 * (input->roads + input->airports_count);
+    if (levels[0] == level) trace->hub_level = level;
+    if (tracer.file) level_started = tracer_level(level, trace->frontiers[trace->levels - 1], level_started);
+    if (discovered == 0) break;
+    bfs_trace_level(trace, discovered);
+    if (levels[until] != IMPOSSIBLE) result = levels[until];
+  }
+  memory_free(levels);
+  return result;
+}
+
+#define SNAPSHOT_MAGIC "EX2G"
+#define SNAPSHOT_VERSION 2
+
+/**
+ * The header of a binary snapshot of a graph. The arrays of the graph follow the header, in their in-memory
+ * representation. Snapshots may only be loaded by builds which use the same identifier and offset widths.
+ */
+typedef struct snapshot_header {
+  char magic[4];
+  uint32_t version;
+  uint8_t city_bytes;
+  uint8_t offset_bytes;
+  uint8_t layout;
+  uint8_t reserved[5];
+  uint64_t size;
+} snapshot_header_t;
+
+/** Writes or reads a whole block of bytes, and returns 1 if this was not possible. */
+static int write_block(FILE *file, const void *data, size_t bytes) {
+  return bytes > 0 && fwrite(data, 1, bytes, file) != bytes;
+}
+
+static int read_block(FILE *file, void *data, size_t bytes) {
+  return bytes > 0 && fread(data, 1, bytes, file) != bytes;
+}
+
+static int write_elias_fano(FILE *file, const elias_fano_t *ef) {
+  uint64_t fields[3] = {ef->count, ef->low_bits, ef->upper_words};
+  return write_block(file, fields, sizeof(fields)) ||
+      write_block(file, ef->lower, ((ef->count * ef->low_bits) / 64 + 2) * sizeof(uint64_t)) ||
+      write_block(file, ef->upper, (ef->upper_words + 1) * sizeof(uint64_t)) ||
+      write_block(file, ef->samples, (ef->count / ELIAS_FANO_SAMPLE_RATE + 1) * sizeof(size_t));
+}
+
+static int read_elias_fano(FILE *file, elias_fano_t *ef) {
+  uint64_t fields[3];
+  if (read_block(file, fields, sizeof(fields))) return 1;
+  ef->count = fields[0];
+  ef->low_bits = fields[1];
+  ef->upper_words = fields[2];
+  ef->lower = (uint64_t *) memory_alloc(MEMORY_SUCCINCT, ((ef->count * ef->low_bits) / 64 + 2) * sizeof(uint64_t),
+                                        false);
+  ef->upper = (uint64_t *) memory_alloc(MEMORY_SUCCINCT, (ef->upper_words + 1) * sizeof(uint64_t), false);
+  ef->samples = (size_t *) memory_alloc(MEMORY_SUCCINCT, (ef->count / ELIAS_FANO_SAMPLE_RATE + 1) * sizeof(size_t),
+                                        false);
+  return !ef->lower || !ef->upper || !ef->samples ||
+      read_block(file, ef->lower, ((ef->count * ef->low_bits) / 64 + 2) * sizeof(uint64_t)) ||
+      read_block(file, ef->upper, (ef->upper_words + 1) * sizeof(uint64_t)) ||
+      read_block(file, ef->samples, (ef->count / ELIAS_FANO_SAMPLE_RATE + 1) * sizeof(size_t));
+}
+
+/**
+ * Writes a binary snapshot of a graph, which can later be loaded without parsing the text input again. The roads which
+ * were added to a graph in the compressed sparse row layout follow the other entries of their cities.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_save(const graph_t *graph, const char *path) {
+  if (graph->extra && graph->layout != GRAPH_LAYOUT_CSR) return 1;
+  FILE *file = fopen(path, "wb");
+  if (!file) return 1;
+  snapshot_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+  header.version = SNAPSHOT_VERSION;
+  header.city_bytes = sizeof(city_slot_t);
+  header.offset_bytes = sizeof(offset_t);
+  header.layout = graph->layout;
+  header.size = graph->size;
+  int error = write_block(file, &header, sizeof(header));
+  if (!error && graph->layout == GRAPH_LAYOUT_CSR && graph->extra) {
+    offset_t offset = 0;
+    for (size_t city = 0; city <= graph->size && !error; city++) {
+      error = write_block(file, &offset, sizeof(offset_t));
+      if (city < graph->size) offset += graph_degree(graph, city);
+    }
+    for (size_t city = 0; city < graph->size && !error; city++) {
+      error = write_block(file, graph->neighbours + graph->start[city],
+                          (graph->start[city + 1] - graph->start[city]) * sizeof(city_slot_t));
+      for (size_t i = 0; i < graph->extra[city].size && !error; i++) {
+        city_slot_t slot;
+        city_store(&slot, (city_t) graph->extra[city].items[i]);
+        error = write_block(file, &slot, sizeof(city_slot_t));
+      }
+    }
+  } else if (!error && graph->layout == GRAPH_LAYOUT_CSR) {
+    error = write_block(file, graph->start, (graph->size + 1) * sizeof(offset_t)) ||
+        write_block(file, graph->neighbours, graph->start[graph->size] * sizeof(city_slot_t));
+  } else if (!error) {
+    uint64_t words = graph->succinct_words;
+    error = write_elias_fano(file, &graph->succinct_start) || write_elias_fano(file, &graph->succinct_lists) ||
+        write_block(file, &words, sizeof(words)) ||
+        write_block(file, graph->succinct_bits, graph->succinct_words * sizeof(uint64_t));
+  }
+  return fclose(file) || error;
+}
+
+/**
+ * Loads a graph from a binary snapshot. The arrays of a snapshot in the compressed sparse row layout are mapped rather
+ * than read, so only the pages which the queries touch are ever loaded.
+ * @return 0, or 1 if an error occurred. The graph is left empty on errors.
+ */
+int graph_load(graph_t *graph, const char *path) {
+  memset(graph, 0, sizeof(graph_t));
+  FILE *file = fopen(path, "rb");
+  if (!file) return 1;
+  snapshot_header_t header;
+  int error = read_block(file, &header, sizeof(header)) || memcmp(header.magic, SNAPSHOT_MAGIC, 4) ||
+      header.version != SNAPSHOT_VERSION || header.city_bytes != sizeof(city_slot_t) ||
+      header.offset_bytes != sizeof(offset_t) || header.layout > GRAPH_LAYOUT_SUCCINCT;
+  if (!error) {
+    graph->size = header.size;
+    graph->layout = (graph_layout_t) header.layout;
+    if (graph->layout == GRAPH_LAYOUT_CSR) {
+      struct stat status;
+      size_t offsets = (graph->size + 1) * sizeof(offset_t);
+      error = fstat(fileno(file), &status) != 0 || (size_t) status.st_size < sizeof(header) + offsets;
+      void *mapping = error ? MAP_FAILED : mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+      if (mapping != MAP_FAILED) {
+        graph->mapping = mapping;
+        graph->mapping_bytes = status.st_size;
+        graph->start = (offset_t *) ((char *) mapping + sizeof(header));
+        graph->neighbours = (city_slot_t *) ((char *) graph->start + offsets);
+      }
+      error = mapping == MAP_FAILED ||
+          (size_t) status.st_size != sizeof(header) + offsets + graph->start[graph->size] * sizeof(city_slot_t);
+    } else {
+      uint64_t words;
+      error = read_elias_fano(file, &graph->succinct_start) || read_elias_fano(file, &graph->succinct_lists) ||
+          read_block(file, &words, sizeof(words)) || words == 0;
+      if (!error) {
+        graph->succinct_words = words;
+        graph->succinct_bits = (uint64_t *) memory_alloc(MEMORY_SUCCINCT, words * sizeof(uint64_t), false);
+        error = !graph->succinct_bits || read_block(file, graph->succinct_bits, words * sizeof(uint64_t));
+      }
+    }
+  }
+  fclose(file);
+  if (error) graph_free(graph);
+  return error;
+}
+
+#define CACHE_MAGIC "EX2C"
+#define CACHE_VERSION 1
+#define CACHE_PATH_LENGTH 4096
+
+/** The indexes of a graph which may be kept in a cache, next to its snapshot. */
+typedef enum cache_index {
+  CACHE_HUB,
+  CACHE_COMPONENTS,
+  CACHE_LABELS,
+} cache_index_t;
+
+const char *cache_index_names[] = {"hub", "components", "labels"};
+
+/** The header of a cached index of a graph, whose arrays follow it. */
+typedef struct cache_header {
+  char magic[4];
+  uint32_t version;
+  uint8_t city_bytes;
+  uint8_t index;
+  uint8_t reserved[6];
+  uint64_t size;
+} cache_header_t;
+
+/**
+ * A directory of preprocessed graphs, which are found from the fingerprint of their input. Each graph has a snapshot,
+ * and the indexes which were computed for it so far. The files are written under a temporary name and then renamed,
+ * so processes which share the directory never see a partial file.
+ */
+typedef struct cache {
+
+  /** The directory, or NULL if nothing is cached. */
+  const char *directory;
+
+  /** The key of the graph of the input, which names its files. */
+  uint64_t key;
+} cache_t;
+
+/** Writes the path of a file of the graph of a cache, and the temporary name under which it is written. */
+static void cache_path(const cache_t *cache, const char *suffix, char *path, char *temporary) {
+  snprintf(path, CACHE_PATH_LENGTH, "%s/%016llx.%s", cache->directory, (unsigned long long) cache->key, suffix);
+  if (temporary) snprintf(temporary, CACHE_PATH_LENGTH + 16, "%s.%d", path, (int) getpid());
+}
+
+/**
+ * Moves a file of the cache which was written under its temporary name to its place.
+ * @param error whether the file could not be written, in which case it is removed.
+ * @return 0, or 1 if an error occurred.
+ */
+static int cache_commit(const char *temporary, const char *path, int error) {
+  if (!error && rename(temporary, path) == 0) return 0;
+  unlink(temporary);
+  return 1;
+}
+
+/**
+ * Looks for the graph of a fingerprint in a cache, and loads its snapshot. The key of the graph also depends on the
+ * widths and the layout of the graphs of this build, since the snapshots of other builds can't be loaded.
+ * @param size the number of cities of the graph, including the hub.
+ * @return whether the graph was found.
+ */
+bool cache_find(cache_t *cache, const fingerprint_t *fingerprint, bool succinct, size_t size, graph_t *graph) {
+  fingerprint_t key = *fingerprint;
+  fingerprint_add(&key, (uint64_t) SNAPSHOT_VERSION << 24 | sizeof(city_slot_t) << 16 | sizeof(offset_t) << 8 | succinct);
+  cache->key = key.hash;
+  char path[CACHE_PATH_LENGTH];
+  cache_path(cache, "graph", path, NULL);
+  if (graph_load(graph, path)) return false;
+  if (graph->size == size && graph->layout == (succinct ? GRAPH_LAYOUT_SUCCINCT : GRAPH_LAYOUT_CSR)) return true;
+  graph_free(graph);
+  return false;
+}
+
+/**
+ * Stores the snapshot of a graph in a cache.
+ * @return 0, or 1 if an error occurred.
+ */
+int cache_store(const cache_t *cache, const graph_t *graph) {
+  char path[CACHE_PATH_LENGTH], temporary[CACHE_PATH_LENGTH + 16];
+  cache_path(cache, "graph", path, temporary);
+  return cache_commit(temporary, path, graph_save(graph, temporary));
+}
+
+/** Opens an index of the graph of a cache, or returns NULL if the cache does not hold it. */
+static FILE *cache_open(const cache_t *cache, cache_index_t index, uint64_t size) {
+  char path[CACHE_PATH_LENGTH];
+  cache_path(cache, cache_index_names[index], path, NULL);
+  FILE *file = fopen(path, "rb");
+  cache_header_t header;
+  if (file && (read_block(file, &header, sizeof(header)) || memcmp(header.magic, CACHE_MAGIC, 4) ||
+               header.version != CACHE_VERSION || header.city_bytes != sizeof(city_t) || header.index != index ||
+               header.size != size)) {
+    fclose(file);
+    return NULL;
+  }
+  return file;
+}
+
+/** Creates the temporary file of an index of the graph of a cache, with its header, or returns NULL. */
+static FILE *cache_create(const cache_t *cache, cache_index_t index, uint64_t size, char *path, char *temporary) {
+  cache_path(cache, cache_index_names[index], path, temporary);
+  FILE *file = fopen(temporary, "wb");
+  cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CACHE_MAGIC, 4);
+  header.version = CACHE_VERSION;
+  header.city_bytes = sizeof(city_t);
+  header.index = index;
+  header.size = size;
+  if (file && write_block(file, &header, sizeof(header))) {
+    fclose(file);
+    unlink(temporary);
+    return NULL;
+  }
+  return file;
+}
+
+/**
+ * Computes the distances to the hub of a graph, or reads them from a cache, where they're stored once computed.
+ * @return 0, or 1 if an error occurred.
+ */
+int cache_index_hub(const cache_t *cache, graph_t *graph, workspace_t *workspace) {
+  if (graph->hub_distances || !cache->directory) return graph_index_hub(graph, workspace);
+  FILE *file = cache_open(cache, CACHE_HUB, graph->size);
+  if (file) {
+    int *distances = (int *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(int), false);
+    int error = !distances || read_block(file, distances, graph->size * sizeof(int));
+    fclose(file);
+    if (!error) {
+      graph->hub_distances = distances;
+      return 0;
+    }
+    memory_free(distances);
+  }
+  if (graph_index_hub(graph, workspace)) return 1;
+  // An index which can't be stored is computed again by the next process, so the error is ignored.
+  char path[CACHE_PATH_LENGTH], temporary[CACHE_PATH_LENGTH + 16];
+  if ((file = cache_create(cache, CACHE_HUB, graph->size, path, temporary))) {
+    int error = write_block(file, graph->hub_distances, graph->size * sizeof(int));
+    cache_commit(temporary, path, fclose(file) || error);
+  }
+  return 0;
+}
+
+/**
+ * Labels the connected components of a graph, or reads them from a cache, where they're stored once computed.
+ * @return 0, or 1 if an error occurred.
+ */
+int cache_index_components(const cache_t *cache, graph_t *graph, workspace_t *workspace) {
+  if (graph->components || !cache->directory) return graph_index_components(graph, workspace);
+  FILE *file = cache_open(cache, CACHE_COMPONENTS, graph->size);
+  if (file) {
+    uint64_t count;
+    city_t *components = (city_t *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(city_t), false);
+    city_t *sizes = (city_t *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(city_t), false);
+    int error = !components || !sizes || read_block(file, &count, sizeof(count)) || count > graph->size ||
+        read_block(file, components, graph->size * sizeof(city_t)) || read_block(file, sizes, count * sizeof(city_t));
+    fclose(file);
+    if (!error) {
+      graph->components = components;
+      graph->component_sizes = sizes;
+      graph->component_count = count;
+      return 0;
+    }
+    memory_free(components);
+    memory_free(sizes);
+  }
+  if (graph_index_components(graph, workspace)) return 1;
+  char path[CACHE_PATH_LENGTH], temporary[CACHE_PATH_LENGTH + 16];
+  if ((file = cache_create(cache, CACHE_COMPONENTS, graph->size, path, temporary))) {
+    uint64_t count = graph->component_count;
+    int error = write_block(file, &count, sizeof(count)) ||
+        write_block(file, graph->components, graph->size * sizeof(city_t)) ||
+        write_block(file, graph->component_sizes, count * sizeof(city_t));
+    cache_commit(temporary, path, fclose(file) || error);
+  }
+  return 0;
+}
+
+/**
+ * Builds the labels of a graph, or reads them from a cache, where they're stored once built. The labels of each city
+ * follow the order and the ranks of the cities, preceded by their count.
+ * @param max_entries the number of labels past which the build gives up, or 0 if there is no limit.
+ * @return 0, or 1 if an error occurred or if the labels have too many entries.
+ */
+int cache_labels_build(const cache_t *cache, labels_t *labels, const graph_t *graph, size_t max_entries) {
+  if (!cache->directory) return labels_build(labels, graph, max_entries);
+  FILE *file = cache_open(cache, CACHE_LABELS, graph->size);
+  if (file) {
+    int error = labels_init(labels, graph->size) || read_block(file, labels->order, graph->size * sizeof(city_t)) ||
+        read_block(file, labels->ranks, graph->size * sizeof(city_t));
+    for (size_t city = 0; city < graph->size && !error; city++) {
+      label_list_t *list = &labels->lists[city];
+      error = read_block(file, &list->size, sizeof(uint32_t));
+      if (error || list->size == 0) continue;
+      list->items = (label_t *) memory_alloc(MEMORY_LABELS, list->size * sizeof(label_t), false);
+      list->capacity = list->size;
+      labels->entries += list->size;
+      error = !list->items || read_block(file, list->items, list->size * sizeof(label_t));
+    }
+    fclose(file);
+    if (!error && max_entries && labels->entries > max_entries) error = 1;
+    else if (!error) return 0;
+    labels_free(labels);
+  }
+  if (labels_build(labels, graph, max_entries)) return 1;
+  char path[CACHE_PATH_LENGTH], temporary[CACHE_PATH_LENGTH + 16];
+  if ((file = cache_create(cache, CACHE_LABELS, graph->size, path, temporary))) {
+    int error = write_block(file, labels->order, graph->size * sizeof(city_t)) ||
+        write_block(file, labels->ranks, graph->size * sizeof(city_t));
+    for (size_t city = 0; city < graph->size && !error; city++) {
+      const label_list_t *list = &labels->lists[city];
+      error = write_block(file, &list->size, sizeof(uint32_t)) ||
+          write_block(file, list->items, list->size * sizeof(label_t));
+    }
+    cache_commit(temporary, path, fclose(file) || error);
+  }
+  return 0;
+}
+
+/**
+ * Parses a number of bytes, which may be followed by a K, M or G suffix.
+ * @return the number of bytes, or 0 if the text is not a valid size.
+ */
+size_t parse_bytes(const char *text) {
+  char *end;
+  unsigned long long value = strtoull(text, &end, 10);
+  switch (*end) {
+    case 'K': value <<= 10; end++; break;
+    case 'M': value <<= 20; end++; break;
+    case 'G': value <<= 30; end++; break;
+    default: break;
+  }
+  return *end == '\0' ? value : 0;
+}
+
+#define EXTERNAL_RUN_BYTES ((size_t) 64 << 20)
+#define EXTERNAL_MIN_RUN_BYTES ((size_t) 64 << 10)
+
+/** Returns the number of bytes of physical memory of the machine, or SIZE_MAX if it is unknown. */
+size_t physical_memory() {
+  long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || page <= 0) return SIZE_MAX;
+  return (size_t) pages * (size_t) page;
+}
+
+/** The ways in which a graph may be built, from the fastest to the most frugal. */
+typedef enum build_plan {
+
+  /** The adjacency lists are allocated, in the compressed sparse row layout. */
+  BUILD_CSR,
+
+  /** The adjacency lists are compressed with the Elias-Fano encoding once they're built. */
+  BUILD_SUCCINCT,
+
+  /** The roads are staged in a temporary file, and the adjacency lists are written to a mapped snapshot file. */
+  BUILD_MAPPED,
+
+  /** The entries are sorted in bounded runs on disk, and merged into a snapshot file which is written sequentially. */
+  BUILD_EXTERNAL,
+  BUILD_PLAN_COUNT,
+} build_plan_t;
+
+/**
+ * Estimates how many bytes of memory are allocated at most while a graph is built with a plan, and then queried.
+ * @param cities the number of cities, including the hub.
+ * @param roads the number of roads between two cities.
+ * @param airports the number of cities with an airport.
+ */
+size_t build_plan_peak(build_plan_t plan, size_t cities, size_t roads, size_t airports) {
+  size_t entries = 2 * (roads + airports);
+  size_t staging = airports * sizeof(city_t) + roads * sizeof(edge_t);
+  size_t csr = (cities + 1) * sizeof(offset_t) + entries * sizeof(city_slot_t);
+  // The queue of a search doubles its capacity until it holds a whole level, so it may hold twice as many cities.
+  size_t workspace = cities * sizeof(bool) + 2 * cities * sizeof(city_t);
+  size_t peak = staging + csr > csr + workspace ? staging + csr : csr + workspace;
+  if (plan == BUILD_SUCCINCT) {
+    size_t succinct = succinct_estimate(cities, entries);
+    peak = staging + csr;
+    if (csr + succinct > peak) peak = csr + succinct;
+    if (succinct + workspace > peak) peak = succinct + workspace;
+  } else if (plan == BUILD_MAPPED) {
+    peak = airports * sizeof(city_t) + workspace;
+  } else if (plan == BUILD_EXTERNAL) {
+    // The runs are sorted and merged before the workspace of the searches is allocated.
+    peak = workspace > EXTERNAL_MIN_RUN_BYTES ? workspace : EXTERNAL_MIN_RUN_BYTES;
+  }
+  return peak;
+}
+
+/**
+ * Picks the fastest plan which builds a graph within a memory budget.
+ * @param succinct whether the adjacency lists must be compressed.
+ * @return the plan, or BUILD_PLAN_COUNT if none fits in the budget.
+ */
+build_plan_t build_plan_choose(const input_t *input, size_t max_memory, bool succinct) {
+  for (build_plan_t plan = succinct ? BUILD_SUCCINCT : BUILD_CSR; plan < BUILD_PLAN_COUNT; plan++) {
+    if (succinct && plan == BUILD_MAPPED) break; // Mapped graphs are not compressed.
+    if (input->weighted && plan != BUILD_CSR) break; // Only the adjacency lists in memory have weights.
+    // The mapped plan writes its adjacency lists in random order, so they must fit in the page cache.
+    size_t lists = 2 * (input->roads + input->airports_count) * sizeof(city_slot_t);
+    if (plan == BUILD_MAPPED && lists > physical_memory()) continue;
+    size_t weights = input->weighted ? (2 * input->airports_count + 3 * input->roads) * sizeof(uint32_t) : 0;
+    if (build_plan_peak(plan, input->cities + 1, input->roads, input->airports_count) + weights <= max_memory) {
+      return plan;
+    }
+  }
+  return BUILD_PLAN_COUNT;
+}
+
+/**
+ * Reads the airports of the input, and writes its roads to a staging file rather than to memory.
+ * @return 0, or 1 if an error occurred.
+ */
+int input_spill(input_t *input, FILE *staging) {
+  input->airports = (city_t *) memory_alloc(MEMORY_AIRPORTS, input->airports_count * sizeof(city_t), false);
+  if (input->airports_count && !input->airports) return 1;
+  for (size_t i = 0; i < input->airports_count; i++) {
+    input->airports[i] = scan_int();
+  }
+  for (size_t i = 0; i < input->roads; i++) {
+    edge_t edge;
+    edge.from = scan_int();
+    edge.to = scan_int();
+    if (fwrite(&edge, sizeof(edge_t), 1, staging) != 1) return 1;
+  }
+  return fflush(staging) != 0;
+}
+
+/**
+ * Builds the compressed sparse row layout of a graph in a snapshot file, which is mapped in memory rather than
+ * allocated. The roads are read twice from the staging file: once to count the degrees, once to fill the adjacency
+ * lists, in the same order as graph_build.
+ * @param path the snapshot file, or NULL if a temporary file is used.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_build_mapped(graph_t *graph, const input_t *input, FILE *staging, const char *path) {
+  size_t m = input->roads, k = input->airports_count;
+  memset(graph, 0, sizeof(graph_t));
+  graph->size = input->cities + 1;
+  graph->layout = GRAPH_LAYOUT_CSR;
+  size_t offsets = (graph->size + 1) * sizeof(offset_t);
+  size_t bytes = sizeof(snapshot_header_t) + offsets + 2 * (m + k) * sizeof(city_slot_t);
+
+  int fd;
+  if (path) {
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  } else {
+    char temporary[] = "/tmp/ex2-graph-XXXXXX";
+    fd = mkstemp(temporary);
+    if (fd >= 0) unlink(temporary);
+  }
+  if (fd < 0) return 1;
+  void *mapping = MAP_FAILED;
+  if (ftruncate(fd, bytes) == 0) mapping = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return 1;
+  graph->mapping = mapping;
+  graph->mapping_bytes = bytes;
+
+  snapshot_header_t *header = (snapshot_header_t *) mapping;
+  memcpy(header->magic, SNAPSHOT_MAGIC, 4);
+  header->version = SNAPSHOT_VERSION;
+  header->city_bytes = sizeof(city_slot_t);
+  header->offset_bytes = sizeof(offset_t);
+  header->layout = GRAPH_LAYOUT_CSR;
+  header->size = graph->size;
+  graph->start = (offset_t *) (header + 1);
+  graph->neighbours = (city_slot_t *) ((char *) graph->start + offsets);
+
+  // The degrees, offsets and insertion cursors are computed in place, like graph_build does.
+  edge_t edge;
+  int error = 0;
+  for (size_t i = 0; i < k; i++) {
+    graph->start[1]++;
+    graph->start[input->airports[i] + 1]++;
+  }
+  rewind(staging);
+  for (size_t i = 0; i < m; i++) {
+    if ((error = fread(&edge, sizeof(edge_t), 1, staging) != 1)) break;
+    graph->start[edge.from + 1]++;
+    graph->start[edge.to + 1]++;
+  }
+  for (size_t i = 1; i <= graph->size; i++) {
+    graph->start[i] += graph->start[i - 1];
+  }
+  rewind(staging);
+  for (size_t i = 0; i < m && !error; i++) {
+    if ((error = fread(&edge, sizeof(edge_t), 1, staging) != 1)) break;
+    city_store(&graph->neighbours[graph->start[edge.from]++], edge.to);
+    city_store(&graph->neighbours[graph->start[edge.to]++], edge.from);
+  }
+  if (error) {
+    graph_free(graph);
+    return 1;
+  }
+  for (size_t i = 0; i < k; i++) {
+    city_t airport = input->airports[i];
+    city_store(&graph->neighbours[graph->start[0]++], airport);
+    city_store(&graph->neighbours[graph->start[airport]++], 0);
+  }
+  for (size_t i = graph->size; i > 0; i--) {
+    graph->start[i] = graph->start[i - 1];
+  }
+  graph->start[0] = 0;
+  return 0;
+}
+
+#define BLOCK_WRITER_CAPACITY (1 << 16)
+
+/** An entry of an adjacency list, with the position of its road in the input, which orders the entries of a city. */
+typedef struct run_entry {
+  city_t from;
+  city_t to;
+  uint64_t order;
+} run_entry_t;
+
+/**
+ * The sorted runs of the adjacency list entries of a graph, which are written one after the other to a temporary file
+ * so the entries never have to be in memory all at once.
+ */
+typedef struct runs {
+  FILE *file;
+
+  /** The entries of the run which is being filled. */
+  run_entry_t *buffer;
+  size_t capacity;
+  size_t size;
+
+  /** The number of entries of each run which was written. */
+  size_t *lengths;
+  size_t count;
+} runs_t;
+
+/** Orders entries by city, and then by position in the input. */
+int run_entry_compare(const void *a, const void *b) {
+  const run_entry_t *x = (const run_entry_t *) a, *y = (const run_entry_t *) b;
+  if (x->from != y->from) return x->from < y->from ? -1 : 1;
+  return (x->order > y->order) - (x->order < y->order);
+}
+
+/**
+ * Sorts the entries of the run which is being filled, and writes it to the file of the runs.
+ * @return 0, or 1 if an error occurred.
+ */
+int runs_flush(runs_t *runs) {
+  if (runs->size == 0) return 0;
+  qsort(runs->buffer, runs->size, sizeof(run_entry_t), run_entry_compare);
+  size_t *lengths = (size_t *) realloc(runs->lengths, (runs->count + 1) * sizeof(size_t));
+  if (!lengths) return 1;
+  runs->lengths = lengths;
+  runs->lengths[runs->count++] = runs->size;
+  int error = fwrite(runs->buffer, sizeof(run_entry_t), runs->size, runs->file) != runs->size;
+  runs->size = 0;
+  return error;
+}
+
+/**
+ * Adds both entries of a road to the runs.
+ * @return 0, or 1 if an error occurred.
+ */
+static int runs_push(runs_t *runs, city_t from, city_t to, uint64_t order) {
+  if (runs->size + 2 > runs->capacity && runs_flush(runs)) return 1;
+  runs->buffer[runs->size++] = (run_entry_t) {from, to, order};
+  runs->buffer[runs->size++] = (run_entry_t) {to, from, order};
+  return 0;
+}
+
+/** Releases the runs, and their file. */
+void runs_free(runs_t *runs) {
+  if (runs->file) fclose(runs->file);
+  memory_free(runs->buffer);
+  free(runs->lengths);
+  memset(runs, 0, sizeof(runs_t));
+}
+
+/**
+ * Reads the airports and roads of the input into sorted runs of bounded size, once the header was read. An airport is
+ * a road to the hub which comes after all the roads, like in graph_build.
+ * @param run_bytes the memory used by the entries of a run.
+ * @return 0, or 1 if an error occurred.
+ */
+int input_spill_runs(input_t *input, runs_t *runs, size_t run_bytes) {
+  memset(runs, 0, sizeof(runs_t));
+  runs->capacity = run_bytes / sizeof(run_entry_t);
+  runs->buffer = (run_entry_t *) memory_alloc(MEMORY_STAGING, runs->capacity * sizeof(run_entry_t), false);
+  runs->file = tmpfile();
+  if (!runs->buffer || !runs->file) return 1;
+  for (size_t i = 0; i < input->airports_count; i++) {
+    if (runs_push(runs, scan_int(), 0, input->roads + i)) return 1;
+  }
+  for (size_t i = 0; i < input->roads; i++) {
+    city_t from = scan_int();
+    city_t to = scan_int();
+    if (runs_push(runs, from, to, i)) return 1;
+  }
+  return runs_flush(runs) || fflush(runs->file) != 0;
+}
+
+/** Writes a region of a file sequentially, through a buffer. */
+typedef struct block_writer {
+  int fd;
+  off_t offset;
+  size_t size;
+  bool failed;
+  char buffer[BLOCK_WRITER_CAPACITY];
+} block_writer_t;
+
+/** Writes the buffer of a writer at its offset in the file. */
+static void block_writer_flush(block_writer_t *writer) {
+  size_t written = 0;
+  while (!writer->failed && written < writer->size) {
+    ssize_t count = pwrite(writer->fd, writer->buffer + written, writer->size - written, writer->offset + written);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) writer->failed = true;
+    else written += count;
+  }
+  writer->offset += writer->size;
+  writer->size = 0;
+}
+
+/** Appends bytes to the region of a writer. */
+static inline void block_writer_put(block_writer_t *writer, const void *data, size_t bytes) {
+  if (writer->size + bytes > BLOCK_WRITER_CAPACITY) block_writer_flush(writer);
+  memcpy(writer->buffer + writer->size, data, bytes);
+  writer->size += bytes;
+}
+
+/** A run which is being merged, with a window of its entries. */
+typedef struct run_cursor {
+  off_t offset;
+  size_t left;
+  run_entry_t *window;
+  size_t index;
+  size_t size;
+} run_cursor_t;
+
+/**
+ * Reads the next window of a run, if its current one was consumed.
+ * @return 0, or 1 if an error occurred.
+ */
+static int run_cursor_fill(run_cursor_t *cursor, int fd, size_t capacity) {
+  if (cursor->index < cursor->size || cursor->left == 0) return 0;
+  size_t count = cursor->left < capacity ? cursor->left : capacity;
+  if (pread(fd, cursor->window, count * sizeof(run_entry_t), cursor->offset) != (ssize_t) (count * sizeof(run_entry_t))) {
+    return 1;
+  }
+  cursor->offset += count * sizeof(run_entry_t);
+  cursor->left -= count;
+  cursor->index = 0;
+  cursor->size = count;
+  return 0;
+}
+
+/** Returns whether the next entry of a run comes before the next entry of another run. */
+static inline bool run_cursor_before(const run_cursor_t *a, const run_cursor_t *b) {
+  return run_entry_compare(&a->window[a->index], &b->window[b->index]) < 0;
+}
+
+/** Moves a run down a min-heap of runs, until it comes before its children. */
+static void run_heap_sift(run_cursor_t **heap, size_t size, size_t i) {
+  while (true) {
+    size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+    if (left < size && run_cursor_before(heap[left], heap[smallest])) smallest = left;
+    if (right < size && run_cursor_before(heap[right], heap[smallest])) smallest = right;
+    if (smallest == i) return;
+    run_cursor_t *swap = heap[i];
+    heap[i] = heap[smallest];
+    heap[smallest] = swap;
+    i = smallest;
+  }
+}
+
+/**
+ * Builds the compressed sparse row layout of a graph in a snapshot file from sorted runs of its entries. The runs are
+ * merged with a heap, and the offsets and the neighbours are both written sequentially, to their own region of the
+ * file, so the file is the same as the one graph_save writes and is then mapped in memory.
+ * @param path the snapshot file, or NULL if a temporary file is used.
+ * @param merge_bytes the memory used by the windows of the runs.
+ * @return 0, or 1 if an error occurred.
+ */
+int graph_build_external(graph_t *graph, const input_t *input, runs_t *runs, const char *path, size_t merge_bytes) {
+  size_t entries = 2 * (input->roads + input->airports_count);
+  memset(graph, 0, sizeof(graph_t));
+  graph->size = input->cities + 1;
+  graph->layout = GRAPH_LAYOUT_CSR;
+  size_t offsets = (graph->size + 1) * sizeof(offset_t);
+  size_t bytes = sizeof(snapshot_header_t) + offsets + entries * sizeof(city_slot_t);
+
+  int fd;
+  if (path) {
+    fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  } else {
+    char temporary[] = "/tmp/ex2-graph-XXXXXX";
+    fd = mkstemp(temporary);
+    if (fd >= 0) unlink(temporary);
+  }
+  if (fd < 0) return 1;
+
+  size_t capacity = merge_bytes / (runs->count + 1) / sizeof(run_entry_t);
+  if (capacity < 64) capacity = 64;
+  run_cursor_t *cursors = (run_cursor_t *) calloc(runs->count + 1, sizeof(run_cursor_t));
+  run_cursor_t **heap = (run_cursor_t **) calloc(runs->count + 1, sizeof(run_cursor_t *));
+  run_entry_t *windows = (run_entry_t *) memory_alloc(MEMORY_STAGING, (runs->count + 1) * capacity *
+                                                                          sizeof(run_entry_t), false);
+  block_writer_t *writers = (block_writer_t *) malloc(2 * sizeof(block_writer_t));
+  int error = !cursors || !heap || !windows || !writers || ftruncate(fd, bytes) != 0;
+  size_t size = 0;
+  off_t offset = 0;
+  for (size_t i = 0; i < runs->count && !error; i++) {
+    cursors[i] = (run_cursor_t) {offset, runs->lengths[i], windows + i * capacity, 0, 0};
+    offset += runs->lengths[i] * sizeof(run_entry_t);
+    error = run_cursor_fill(&cursors[i], fileno(runs->file), capacity);
+    if (cursors[i].size > 0) heap[size++] = &cursors[i];
+  }
+  for (size_t i = size / 2; i-- > 0 && !error;) run_heap_sift(heap, size, i);
+
+  if (!error) {
+    snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, 4);
+    header.version = SNAPSHOT_VERSION;
+    header.city_bytes = sizeof(city_slot_t);
+    header.offset_bytes = sizeof(offset_t);
+    header.layout = GRAPH_LAYOUT_CSR;
+    header.size = graph->size;
+    writers[0].fd = writers[1].fd = fd;
+    writers[0].size = writers[1].size = 0;
+    writers[0].failed = writers[1].failed = false;
+    writers[0].offset = 0;
+    writers[1].offset = sizeof(snapshot_header_t) + offsets;
+    block_writer_put(&writers[0], &header, sizeof(header));
+  }
+  // The offset of each city is written once all the entries of the cities before it were.
+  offset_t written = 0;
+  size_t city = 0;
+  while (size > 0 && !error) {
+    run_cursor_t *cursor = heap[0];
+    run_entry_t entry = cursor->window[cursor->index++];
+    for (; city <= entry.from; city++) block_writer_put(&writers[0], &written, sizeof(offset_t));
+    city_slot_t slot;
+    city_store(&slot, entry.to);
+    block_writer_put(&writers[1], &slot, sizeof(city_slot_t));
+    written++;
+    error = run_cursor_fill(cursor, fileno(runs->file), capacity);
+    if (cursor->index == cursor->size) heap[0] = heap[--size];
+    run_heap_sift(heap, size, 0);
+  }
+  if (!error) {
+    for (; city <= graph->size; city++) block_writer_put(&writers[0], &written, sizeof(offset_t));
+    block_writer_flush(&writers[0]);
+    block_writer_flush(&writers[1]);
+    error = writers[0].failed || writers[1].failed || written != entries;
+  }
+  free(cursors);
+  free(heap);
+  memory_free(windows);
+  free(writers);
+
+  void *mapping = error ? MAP_FAILED : mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED) return 1;
+  graph->mapping = mapping;
+  graph->mapping_bytes = bytes;
+  graph->start = (offset_t *) ((char *) mapping + sizeof(snapshot_header_t));
+  graph->neighbours = (city_slot_t *) ((char *) graph->start + offsets);
+  return 0;
+}
+
+/** The engines which may answer a distance query. */
+typedef enum engine {
+  ENGINE_BFS,
+  ENGINE_SHARDED,
+  ENGINE_EDGES,
+  ENGINE_DELTA,
+  ENGINE_LABELS,
+  ENGINE_COUNT,
+} engine_t;
+
+const char *engine_names[ENGINE_COUNT] = {"bfs", "sharded", "edges", "delta", "labels"};
+
+/** How a distance query was answered. */
+typedef enum outcome {
+  OUTCOME_FOUND,
+  OUTCOME_IMPOSSIBLE,
+  OUTCOME_BOUNDED,
+  OUTCOME_COUNT,
+} outcome_t;
+
+const char *outcome_names[OUTCOME_COUNT] = {"found", "impossible", "bounded"};
+
+/** Returns the outcome of a query which returned the provided result. */
+static inline outcome_t outcome_of(int result) {
+  return result == IMPOSSIBLE ? OUTCOME_IMPOSSIBLE : result == BOUNDED ? OUTCOME_BOUNDED : OUTCOME_FOUND;
+}
+
+/**
+ * Formats the answer to a distance query: the distance, Impossible, or the bounds of a cancelled query, written as
+ * LOWER..UPPER, or >=LOWER when no upper bound is known.
+ */
+void format_result(char *text, size_t capacity, int result, const bounds_t *bounds) {
+  if (result == IMPOSSIBLE) {
+    snprintf(text, capacity, "Impossible");
+  } else if (result == BOUNDED && bounds->upper == IMPOSSIBLE) {
+    snprintf(text, capacity, ">=%d", bounds->lower);
+  } else if (result == BOUNDED) {
+    snprintf(text, capacity, "%d..%d", bounds->lower, bounds->upper);
+  } else {
+    snprintf(text, capacity, "%d", result);
+  }
+}
+
+// Each power of two is split in 2^HISTOGRAM_SUB_BITS buckets, so a recorded value is off by at most 1/32. The values
+// below 2^HISTOGRAM_SUB_BITS have a bucket each, and are followed by the powers of two up to 2^63.
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS)
+
+/**
+ * A histogram of latencies in nanoseconds, with buckets whose width grows with their value, like an HDR histogram.
+ */
+typedef struct histogram {
+
+  /** The number of values recorded in each bucket. */
+  uint64_t counts[HISTOGRAM_BUCKETS];
+
+  /** The number of values recorded. */
+  uint64_t total;
+
+  /** The sum of the values recorded. */
+  uint64_t sum;
+
+  /** The largest value recorded. */
+  uint64_t max;
+} histogram_t;
+
+/** Returns the bucket in which a value is recorded. */
+static inline size_t histogram_bucket(uint64_t value) {
+  if (value < HISTOGRAM_SUB_BUCKETS) return value;
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS;
+  return (size_t) shift * HISTOGRAM_SUB_BUCKETS + (value >> shift);
+}
+
+/** Returns the smallest value which is recorded in a bucket. */
+static inline uint64_t histogram_value(size_t bucket) {
+  if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+  size_t shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+  return (uint64_t) (bucket - shift * HISTOGRAM_SUB_BUCKETS) << shift;
+}
+
+/** Records a value in a histogram. */
+void histogram_record(histogram_t *histogram, uint64_t value) {
+  histogram->counts[histogram_bucket(value)]++;
+  histogram->total++;
+  histogram->sum += value;
+  if (value > histogram->max) histogram->max = value;
+}
+
+/** Returns the value below which the provided fraction of the recorded values are. */
+uint64_t histogram_quantile(const histogram_t *histogram, double quantile) {
+  if (histogram->total == 0) return 0;
+  uint64_t rank = (uint64_t) (quantile * (histogram->total - 1)) + 1, seen = 0;
+  for (size_t bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+    seen += histogram->counts[bucket];
+    if (seen >= rank) return histogram_value(bucket);
+  }
+  return histogram->max;
+}
+
+/**
+ * The counters of a long-lived process, which are exported in the Prometheus text format.
+ */
+typedef struct metrics {
+
+  /** The time at which the process started. */
+  uint64_t started;
+
+  /** The latency of the queries, for each engine and each outcome. */
+  histogram_t latencies[ENGINE_COUNT][OUTCOME_COUNT];
+} metrics_t;
+
+/** Records the latency of a query. */
+void metrics_record(metrics_t *metrics, engine_t engine, outcome_t outcome, uint64_t latency) {
+  histogram_record(&metrics->latencies[engine][outcome], latency);
+}
+
+/** Writes the metrics in the Prometheus text format. */
+void metrics_write(const metrics_t *metrics, FILE *out) {
+  static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  fprintf(out, "# HELP ex2_query_latency_seconds The latency of the distance queries.\n");
+  fprintf(out, "# TYPE ex2_query_latency_seconds summary\n");
+  for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+    for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+      const histogram_t *histogram = &metrics->latencies[engine][outcome];
+      if (histogram->total == 0) continue;
+      const char *e = engine_names[engine], *o = outcome_names[outcome];
+      for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++) {
+        fprintf(out, "ex2_query_latency_seconds{engine=\"%s\",outcome=\"%s\",quantile=\"%g\"} %.9f\n", e, o,
+                quantiles[i], histogram_quantile(histogram, quantiles[i]) / 1e9);
+      }
+      fprintf(out, "ex2_query_latency_seconds_sum{engine=\"%s\",outcome=\"%s\"} %.9f\n", e, o, histogram->sum / 1e9);
+      fprintf(out, "ex2_query_latency_seconds_count{engine=\"%s\",outcome=\"%s\"} %llu\n", e, o,
+              (unsigned long long) histogram->total);
+    }
+  }
+  fprintf(out, "# HELP ex2_query_latency_max_seconds The largest latency of the distance queries.\n");
+  fprintf(out, "# TYPE ex2_query_latency_max_seconds gauge\n");
+  for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+    for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+      const histogram_t *histogram = &metrics->latencies[engine][outcome];
+      if (histogram->total == 0) continue;
+      fprintf(out, "ex2_query_latency_max_seconds{engine=\"%s\",outcome=\"%s\"} %.9f\n", engine_names[engine],
+              outcome_names[outcome], histogram->max / 1e9);
+    }
+  }
+  fprintf(out, "# HELP ex2_queries_total The number of distance queries which were answered.\n");
+  fprintf(out, "# TYPE ex2_queries_total counter\n");
+  for (int engine = 0; engine < ENGINE_COUNT; engine++) {
+    for (int outcome = 0; outcome < OUTCOME_COUNT; outcome++) {
+      fprintf(out, "ex2_queries_total{engine=\"%s\",outcome=\"%s\"} %llu\n", engine_names[engine],
+              outcome_names[outcome], (unsigned long long) metrics->latencies[engine][outcome].total);
+    }
+  }
+  fprintf(out, "# HELP ex2_uptime_seconds The time since the process started.\n");
+  fprintf(out, "# TYPE ex2_uptime_seconds gauge\n");
+  fprintf(out, "ex2_uptime_seconds %.3f\n", (now_ns() - metrics->started) / 1e9);
+}
+
+/**
+ * Writes the metrics to a file. The metrics are first written to a temporary file, which then replaces the previous
+ * one, so a scraper never reads a partial file.
+ * @return 0, or 1 if an error occurred.
+ */
+int metrics_export(const metrics_t *metrics, const char *path) {
+  size_t length = strlen(path);
+  char *temporary = (char *) malloc(length + 5);
+  if (!temporary) return 1;
+  memcpy(temporary, path, length);
+  memcpy(temporary + length, ".tmp", 5);
+  FILE *file = fopen(temporary, "w");
+  int error = !file;
+  if (file) {
+    metrics_write(metrics, file);
+    error = fclose(file) != 0 || rename(temporary, path) != 0;
+  }
+  free(temporary);
+  return error;
+}
+
+// The metrics file of a server is rewritten at most once per interval.
+#define METRICS_EXPORT_INTERVAL_NS 1000000000ULL
+
+#define DEFAULT_SLOW_THRESHOLD_NS 10000000ULL
+
+/**
+ * The time spent in each phase of a query, in nanoseconds. The phases which did not happen for a query are 0.
+ */
+typedef struct phases {
+
+  /** The time spent parsing the text input. */
+  uint64_t scan;
+
+  /** The time spent building the graph from the input. */
+  uint64_t build;
+
+  /** The time spent loading the snapshot of the graph. */
+  uint64_t load;
+
+  /** The time spent searching the graph. */
+  uint64_t solve;
+} phases_t;
+
+/**
+ * A log of the queries which took longer than a threshold, with the shape of their traversal.
+ */
+typedef struct slow_log {
+
+  /** The file in which the queries are logged, or NULL if the log is disabled. */
+  FILE *file;
+
+  /** The total time above which a query is logged, in nanoseconds. */
+  uint64_t threshold;
+} slow_log_t;
+
+/**
+ * Logs a query if it took longer than the threshold of the log. Each query is logged on a single line, which ends with
+ * the number of cities expanded at each level of the search.
+ * @param graph the name of the graph, or NULL if the process only has one graph.
+ */
+void slow_log_record(const slow_log_t *log, const char *graph, engine_t engine, city_t from, city_t until,
+                     int result, const phases_t *phases, const bfs_trace_t *trace) {
+  if (!log->file) return;
+  uint64_t total = phases->scan + phases->build + phases->load + phases->solve;
+  if (total < log->threshold) return;
+  fprintf(log->file, "slow engine=%s", engine_names[engine]);
+  if (graph) fprintf(log->file, " graph=%s", graph);
+  fprintf(log->file, " from=%llu until=%llu", (unsigned long long) from, (unsigned long long) until);
+  char answer[32];
+  format_result(answer, sizeof(answer), result, &(bounds_t) {0, IMPOSSIBLE});
+  fprintf(log->file, " result=%s", result == BOUNDED ? outcome_names[OUTCOME_BOUNDED] : answer);
+  fprintf(log->file, " total_us=%llu scan_us=%llu build_us=%llu load_us=%llu solve_us=%llu",
+          (unsigned long long) total / 1000, (unsigned long long) phases->scan / 1000,
+          (unsigned long long) phases->build / 1000, (unsigned long long) phases->load / 1000,
+          (unsigned long long) phases->solve / 1000);
+  fprintf(log->file, " edges=%llu hub_level=%d levels=%zu frontiers=", (unsigned long long) trace->edges,
+          trace->hub_level, trace->levels);
+  for (size_t i = 0; i < trace->levels; i++) {
+    fprintf(log->file, i == 0 ? "%llu" : ",%llu", (unsigned long long) trace->frontiers[i]);
+  }
+  fprintf(log->file, "\n");
+  fflush(log->file);
+}
+
+#define WORKLOAD_MAGIC "EX2W"
+#define WORKLOAD_VERSION 1
+
+/** The kinds of records of a workload log. */
+typedef enum workload_record {
+  WORKLOAD_QUERY,
+  WORKLOAD_LOAD,
+  WORKLOAD_UNLOAD,
+  WORKLOAD_ROAD,
+} workload_record_t;
+
+/**
+ * A binary log of the queries and graph changes seen by the process, which can be replayed later. Each record starts
+ * with its kind and the time elapsed since the previous record, followed by its fields. All the integers are stored
+ * as variable-length integers, so most records only take a few bytes. The graphs are identified by the order in which
+ * they were first registered.
+ */
+typedef struct workload {
+
+  /** The file of the log. */
+  FILE *file;
+
+  /** The time at which the previous record was written, or its offset in the log when it was read. */
+  uint64_t previous;
+
+  /** The number of records which were read. */
+  size_t records;
+} workload_t;
+
+/** Writes an integer with 7 bits per byte, where the high bit of each byte tells whether more bytes follow. */
+static void write_varint(FILE *file, uint64_t value) {
+  while (value >= 0x80) {
+    fputc((int) (value & 0x7F) | 0x80, file);
+    value >>= 7;
+  }
+  fputc((int) value, file);
+}
+
+/** Reads an integer written by write_varint, and returns 1 if the end of the file was reached. */
+static int read_varint(FILE *file, uint64_t *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    int byte = fgetc(file);
+    if (byte == EOF) return 1;
+    *value |= (uint64_t) (byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return 0;
+  }
+  return 1;
+}
+
+/**
+ * Creates a workload log, which records the following queries and graph changes.
+ * @return 0, or 1 if an error occurred.
+ */
+int workload_create(workload_t *workload, const char *path) {
+  workload->file = fopen(path, "wb");
+  if (!workload->file) return 1;
+  uint32_t version = WORKLOAD_VERSION;
+  workload->previous = now_ns();
+  return write_block(workload->file, WORKLOAD_MAGIC, 4) || write_block(workload->file, &version, sizeof(version));
+}
+
+/**
+ * Opens a workload log, so its records can be replayed.
+ * @return 0, or 1 if an error occurred.
+ */
+int workload_open(workload_t *workload, const char *path) {
+  workload->file = fopen(path, "rb");
+  if (!workload->file) return 1;
+  char magic[4];
+  uint32_t version;
+  workload->previous = 0;
+  workload->records = 0;
+  return read_block(workload->file, magic, 4) || memcmp(magic, WORKLOAD_MAGIC, 4) ||
+      read_block(workload->file, &version, sizeof(version)) || version != WORKLOAD_VERSION;
+}
+
+/** Starts a record of the provided kind. */
+static void workload_begin(workload_t *workload, workload_record_t kind) {
+  uint64_t now = now_ns();
+  fputc(kind, workload->file);
+  write_varint(workload->file, now - workload->previous);
+  workload->previous = now;
+}
+
+static void write_string(FILE *file, const char *text) {
+  size_t length = strlen(text);
+  write_varint(file, length);
+  write_block(file, text, length);
+}
+
+/** Records a distance query on a graph. */
+void workload_query(workload_t *workload, size_t graph, uint64_t from, uint64_t until) {
+  if (!workload || !workload->file) return;
+  workload_begin(workload, WORKLOAD_QUERY);
+  write_varint(workload->file, graph);
+  write_varint(workload->file, from);
+  write_varint(workload->file, until);
+}
+
+/** Records the registration of the snapshot of a graph. */
+void workload_load(workload_t *workload, size_t graph, const char *name, const char *path) {
+  if (!workload || !workload->file) return;
+  workload_begin(workload, WORKLOAD_LOAD);
+  write_varint(workload->file, graph);
+  write_string(workload->file, name);
+  write_string(workload->file, path);
+}
+
+/** Records the eviction of a graph. */
+void workload_unload(workload_t *workload, size_t graph) {
+  if (!workload || !workload->file) return;
+  workload_begin(workload, WORKLOAD_UNLOAD);
+  write_varint(workload->file, graph);
+}
+
+/** Records a road or an airport added to a graph, where an airport is a road to the hub. */
+void workload_road(workload_t *workload, size_t graph, uint64_t from, uint64_t to) {
+  if (!workload || !workload->file) return;
+  workload_begin(workload, WORKLOAD_ROAD);
+  write_varint(workload->file, graph);
+  write_varint(workload->file, from);
+  write_varint(workload->file, to);
+}
+
+/**
+ * A record which was read back from a workload log.
+ */
+typedef struct workload_entry {
+
+  /** The kind of the record. */
+  workload_record_t kind;
+
+  /** The time elapsed since the first record, in nanoseconds. */
+  uint64_t offset;
+
+  /** The graph of the record. */
+  uint64_t graph;
+
+  /** The cities of a query, or the ends of a road. */
+  uint64_t from, until;
+
+  /** The name and the snapshot of a registered graph. */
+  char name[64];
+  char path[4096];
+} workload_entry_t;
+
+static int read_string(FILE *file, char *text, size_t capacity) {
+  uint64_t length;
+  if (read_varint(file, &length) || length >= capacity || read_block(file, text, length)) return 1;
+  text[length] = '\0';
+  return 0;
+}
+
+/**
+ * Reads the next record of a workload log.
+ * @return 0, or 1 if there are no more records.
+ */
+int workload_next(workload_t *workload, workload_entry_t *entry) {
+  int kind = fgetc(workload->file);
+  uint64_t delta;
+  if (kind == EOF || read_varint(workload->file, &delta) || read_varint(workload->file, &entry->graph)) return 1;
+  entry->kind = (workload_record_t) kind;
+  // The time between the creation of the log and its first record is not replayed.
+  if (workload->records++ > 0) workload->previous += delta;
+  entry->offset = workload->previous;
+  switch (entry->kind) {
+    case WORKLOAD_QUERY:
+    case WORKLOAD_ROAD:
+      return read_varint(workload->file, &entry->from) || read_varint(workload->file, &entry->until);
+    case WORKLOAD_LOAD:
+      return read_string(workload->file, entry->name, sizeof(entry->name)) ||
+          read_string(workload->file, entry->path, sizeof(entry->path));
+    case WORKLOAD_UNLOAD:
+      return 0;
+    default:
+      return 1;
+  }
+}
+
+#define TENANT_NAME_LENGTH 64
+#define SERVER_LINE_LENGTH 4096
+
+#define DELTA_LOG_MAGIC "EX2D"
+#define DELTA_LOG_VERSION 1
+#define DELTA_LOG_PATH_LENGTH (SERVER_LINE_LENGTH + 16)
+#define DELTA_LOG_COMPACT_ROADS 65536
+
+/**
+ * The header of the delta log of a snapshot, which lists the roads which were added to its graph since it was written.
+ * Each road is stored as two variable-length integers, and an airport is a road to the hub. The log remembers how many
+ * adjacency list entries its snapshot had, so the roads which a compacted snapshot already holds are not added twice.
+ */
+typedef struct delta_log_header {
+  char magic[4];
+  uint32_t version;
+  uint64_t base;
+} delta_log_header_t;
+
+/**
+ * Opens the delta log of a snapshot, or creates it, and adds the roads it lists to the graph which was just loaded from
+ * the snapshot. A road which was only partly written when the process stopped is dropped from the log.
+ * @param roads where the number of roads of the log which are not in the snapshot is stored.
+ * @return 0, or 1 if an error occurred.
+ */
+int delta_log_open(FILE **log, size_t *roads, const char *path, graph_t *graph) {
+  char name[DELTA_LOG_PATH_LENGTH];
+  snprintf(name, sizeof(name), "%s.log", path);
+  delta_log_header_t header;
+  uint64_t entries = graph_start(graph, graph->size);
+  *roads = 0;
+  FILE *file = fopen(name, "r+b");
+  if (!file) {
+    memcpy(header.magic, DELTA_LOG_MAGIC, 4);
+    header.version = DELTA_LOG_VERSION;
+    header.base = entries;
+    file = fopen(name, "w+b");
+    if (!file || write_block(file, &header, sizeof(header)) || fflush(file) != 0) {
+      if (file) fclose(file);
+      return 1;
+    }
+    *log = file;
+    return 0;
+  }
+  int error = read_block(file, &header, sizeof(header)) || memcmp(header.magic, DELTA_LOG_MAGIC, 4) ||
+      header.version != DELTA_LOG_VERSION || header.base > entries || (entries - header.base) % 2 != 0;
+  // The snapshot was compacted, but the process stopped before the roads it holds were removed from the log.
+  uint64_t skip = error ? 0 : (entries - header.base) / 2;
+  long end = sizeof(header);
+  uint64_t from, to;
+  while (!error && !read_varint(file, &from) && !read_varint(file, &to)) {
+    error = from >= graph->size || to >= graph->size;
+    if (!error && skip > 0) {
+      skip--;
+    } else if (!error) {
+      error = graph_add_road(graph, from, to);
+      (*roads)++;
+    }
+    end = ftell(file);
+  }
+  error = error || skip > 0 || ftruncate(fileno(file), end) != 0 || fseek(file, end, SEEK_SET) != 0;
+  if (error) {
+    fclose(file);
+    return 1;
+  }
+  *log = file;
+  return 0;
+}
+
+/**
+ * Appends a road to a delta log, and waits until it is stored on disk.
+ * @return 0, or 1 if an error occurred.
+ */
+int delta_log_append(FILE *log, city_t from, city_t to) {
+  write_varint(log, from);
+  write_varint(log, to);
+  return fflush(log) != 0 || ferror(log) || fdatasync(fileno(log)) != 0;
+}
+
+/**
+ * The compaction of a snapshot and its delta log, whose new snapshot is written by a child process while the server
+ * keeps answering queries.
+ */
+typedef struct compaction {
+
+  /** The child process which writes the new snapshot, or 0 if no compaction runs. */
+  pid_t pid;
+
+  /** The snapshot which is compacted. */
+  char *path;
+
+  /** The number of adjacency list entries of the new snapshot. */
+  uint64_t base;
+
+  /** The size of the delta log when the compaction started. The roads which follow are kept in the new log. */
+  long offset;
+
+  /** The number of roads of the delta log which are in the new snapshot. */
+  size_t roads;
+} compaction_t;
+
+/**
+ * Starts to write a snapshot of a graph with the roads which were added to it, in a child process which sees the graph
+ * as it is now.
+ * @param log the delta log of the snapshot.
+ * @param roads the number of roads of the delta log.
+ * @return 0, or 1 if an error occurred.
+ */
+int compaction_start(compaction_t *compaction, const graph_t *graph, const char *path, FILE *log, size_t roads) {
+  char temporary[DELTA_LOG_PATH_LENGTH];
+  snprintf(temporary, sizeof(temporary), "%s.compact", path);
+  long offset = ftell(log);
+  char *copy = strdup(path);
+  pid_t pid = offset < 0 || !copy ? -1 : fork();
+  if (pid < 0) {
+    free(copy);
+    return 1;
+  }
+  if (pid == 0) {
+    int error = graph_save(graph, temporary);
+    int fd = error ? -1 : open(temporary, O_RDONLY);
+    _exit(error || fd < 0 || fsync(fd) != 0);
+  }
+  compaction->pid = pid;
+  compaction->path = copy;
+  compaction->base = graph_start(graph, graph->size) + 2 * graph->extra_roads;
+  compaction->offset = offset;
+  compaction->roads = roads;
+  return 0;
+}
+
+/**
+ * Completes a compaction once its child process exited. The new snapshot replaces the old one, and then the delta log
+ * is rewritten with only the roads which were added after the compaction started.
+ * @param wait whether to wait for the child process, rather than return while it still runs.
+ * @param log the open delta log of the snapshot, which is replaced by the new log, or NULL.
+ * @return 0, or 1 if an error occurred.
+ */
+int compaction_finish(compaction_t *compaction, bool wait, FILE **log) {
+  int status;
+  pid_t pid = waitpid(compaction->pid, &status, wait ? 0 : WNOHANG);
+  if (pid == 0) return 0;
+  char temporary[DELTA_LOG_PATH_LENGTH], name[DELTA_LOG_PATH_LENGTH], rewritten[DELTA_LOG_PATH_LENGTH];
+  snprintf(temporary, sizeof(temporary), "%s.compact", compaction->path);
+  snprintf(name, sizeof(name), "%s.log", compaction->path);
+  snprintf(rewritten, sizeof(rewritten), "%s.log.compact", compaction->path);
+  int error = pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || rename(temporary, compaction->path) != 0;
+  if (error) unlink(temporary);
+
+  // A process which stops before the log is replaced skips the roads which the new snapshot holds when it restarts.
+  FILE *old = error ? NULL : fopen(name, "rb");
+  FILE *new = old ? fopen(rewritten, "w+b") : NULL;
+  error = error || !new || fseek(old, compaction->offset, SEEK_SET) != 0;
+  if (!error) {
+    delta_log_header_t header;
+    memcpy(header.magic, DELTA_LOG_MAGIC, 4);
+    header.version = DELTA_LOG_VERSION;
+    header.base = compaction->base;
+    error = write_block(new, &header, sizeof(header));
+    char buffer[4096];
+    for (size_t count; !error && (count = fread(buffer, 1, sizeof(buffer), old)) > 0;) {
+      error = write_block(new, buffer, count);
+    }
+    error = error || ferror(old) || fflush(new) != 0 || fdatasync(fileno(new)) != 0 || rename(rewritten, name) != 0;
+  }
+  if (old) fclose(old);
+  if (error && new) unlink(rewritten);
+  if (!error && log && *log) {
+    fclose(*log);
+    *log = new;
+    error = fseek(new, 0, SEEK_END) != 0;
+  } else if (new) {
+    fclose(new);
+  }
+  free(compaction->path);
+  compaction->path = NULL;
+  compaction->pid = 0;
+  return error;
+}
+
+/**
+ * A named graph which is served by the process. Its snapshot is loaded when it is first queried, and it may be
+ * evicted when other graphs need the memory.
+ */
+typedef struct tenant {
+
+  /** The name with which the queries address the graph. */
+  char name[TENANT_NAME_LENGTH];
+
+  /** The path of the binary snapshot of the graph. */
+  char *path;
+
+  /** Whether the graph is currently loaded. */
+  bool loaded;
+
+  /** The graph, when it is loaded. */
+  graph_t graph;
+
+  /** The number of bytes used by the graph, when it is loaded. */
+  size_t bytes;
+
+  /** The time at which the graph was last queried, used to evict the least recently used graphs. */
+  uint64_t last_used;
+
+  /** The number of queries which were answered with the graph. */
+  size_t queries;
+
+  /** How many times the graph was loaded. */
+  size_t loads;
+
+  /** The distance labels of the graph, when they were built. */
+  labels_t labels;
+
+  /**
+   * Whether roads or airports were added to the graph since it was loaded, without a delta log from which they're added
+   * again, in which case it is never evicted.
+   */
+  bool changed;
+
+  /** The delta log of the snapshot of the graph, when it is loaded by a server which keeps one, or NULL. */
+  FILE *log;
+
+  /** The number of roads of the delta log which are not in the snapshot. */
+  size_t logged;
+
+  /** The compaction of the snapshot of the graph, which may run while the graph is evicted. */
+  compaction_t compaction;
+} tenant_t;
+
+#define SCHEDULE_LANES 3
+#define SCHEDULE_WINDOW 1024
+
+/**
+ * A query which waits to be answered by a scheduling server. The queries are answered by increasing lane, and by
+ * increasing cost within a lane, which lets cheap queries overtake the searches which traverse whole graphs.
+ */
+typedef struct pending_query {
+  char name[TENANT_NAME_LENGTH];
+  uint64_t from;
+  uint64_t until;
+
+  /** The resources the query may use, counted from its arrival. */
+  budget_t budget;
+  bool budgeted;
+
+  /** The priority lane of the query, from 0 (the most urgent) to SCHEDULE_LANES - 1. */
+  unsigned lane;
+
+  /** The estimated number of cities which the query expands. */
+  uint64_t cost;
+
+  /** The position of the query in its window, which keeps the order of queries of equal cost. */
+  size_t arrival;
+} pending_query_t;
+
+/**
+ * The state of a server, which holds several named graphs and a workspace shared by all of their queries.
+ */
+typedef struct server {
+
+  /** The graphs which are known to the server. */
+  tenant_t *tenants;
+
+  /** The number of graphs known to the server. */
+  size_t count;
+
+  /** The number of graphs which may be known before the tenants array grows. */
+  size_t capacity;
+
+  /** The number of bytes which may be used by the loaded graphs. 0 if there is no limit. */
+  size_t max_resident;
+
+  /** The number of bytes used by the loaded graphs. */
+  size_t resident;
+
+  /** The workspace used by the queries of all the graphs. */
+  workspace_t workspace;
+
+  /** The latencies of the queries of all the graphs. */
+  metrics_t metrics;
+
+  /** The file to which the metrics are exported, or NULL. */
+  const char *metrics_path;
+
+  /** The time at which the metrics were last exported. */
+  uint64_t exported;
+
+  /** The log of the slowest queries. */
+  slow_log_t slow_log;
+
+  /** The log in which the queries and graph changes are recorded, or NULL. */
+  workload_t *recorder;
+
+  /** The default time budget of the queries, in nanoseconds, or 0 if they're not limited. */
+  uint64_t budget_time;
+
+  /** The default number of adjacency list entries which the queries may scan, or 0 if they're not limited. */
+  uint64_t budget_edges;
+
+  /** Whether the queries are reordered by expected cost, rather than answered in the order in which they arrive. */
+  bool schedule;
+
+  /** Whether the roads and airports added to the graphs are appended to a delta log next to their snapshot. */
+  bool delta_log;
+
+  /** The queries which arrived but were not answered yet, when they're scheduled. */
+  pending_query_t *pending;
+
+  /** The number of pending queries. */
+  size_t pending_count;
+} server_t;
+
+/** Returns the graph with the provided name, or NULL if the server does not know about it. */
+tenant_t *server_find(server_t *server, const char *name) {
+  for (size_t i = 0; i < server->count; i++) {
+    if (strcmp(server->tenants[i].name, name) == 0) return &server->tenants[i];
+  }
+  return NULL;
+}
+
+/** Unloads a graph, so its memory can be used by other graphs. */
+void server_evict(server_t *server, tenant_t *tenant) {
+  if (!tenant->loaded) return;
+  graph_free(&tenant->graph);
+  labels_free(&tenant->labels);
+  if (tenant->log) fclose(tenant->log);
+  tenant->log = NULL;
+  server->resident -= tenant->bytes;
+  tenant->bytes = 0;
+  tenant->loaded = false;
+  tenant->changed = false;
+}
+
+/**
+ * Loads the snapshot of a graph if needed. The least recently used graphs are evicted until the new graph fits in the
+ * memory budget of the server.
+ * @return 0, or 1 if an error occurred.
+ */
+int server_acquire(server_t *server, tenant_t *tenant) {
+  tenant->last_used = now_ns();
+  if (tenant->loaded) return 0;
+  if (graph_load(&tenant->graph, tenant->path)) return 1;
+  if (server->delta_log && delta_log_open(&tenant->log, &tenant->logged, tenant->path, &tenant->graph)) {
+    graph_free(&tenant->graph);
+    return 1;
+  }
+  tracer_span("load", getpid(), 0, tenant->last_used, now_ns(), NULL);
+  tenant->bytes = graph_bytes(&tenant->graph);
+  tenant->loaded = true;
+  tenant->loads++;
+  server->resident += tenant->bytes;
+  while (server->max_resident && server->resident > server->max_resident) {
+    tenant_t *victim = NULL;
+    for (size_t i = 0; i < server->count; i++) {
+      tenant_t *candidate = &server->tenants[i];
+      if (candidate == tenant || !candidate->loaded || candidate->changed) continue;
+      if (!victim || candidate->last_used < victim->last_used) victim = candidate;
+    }
+    if (!victim) break; // The graph is larger than the budget on its own, but it is still served.
+    server_evict(server, victim);
+  }
+  return 0;
+}
+
+/** The trace of the queries which are answered without a search. */
+static const bfs_trace_t untraced = {.hub_level = -1};
+
+/** Updates the number of bytes used by a loaded graph, after its indexes or its roads changed. */
+void server_account(server_t *server, tenant_t *tenant) {
+  size_t bytes = graph_bytes(&tenant->graph) + labels_bytes(&tenant->labels);
+  server->resident += bytes - tenant->bytes;
+  tenant->bytes = bytes;
+}
+
+/**
+ * Computes the indexes of a loaded graph: the distances to the hub, and its components if they're requested. Graphs
+ * whose indexes can't be allocated are still served, without them.
+ */
+void server_index(server_t *server, tenant_t *tenant, bool components) {
+  graph_index_hub(&tenant->graph, &server->workspace);
+  if (components) graph_index_components(&tenant->graph, &server->workspace);
+  server_account(server, tenant);
+}
+
+/**
+ * Registers a graph under the provided name, or changes the snapshot of an existing graph.
+ * @return 0, or 1 if an error occurred.
+ */
+int server_register(server_t *server, const char *name, const char *path) {
+  if (strlen(name) >= TENANT_NAME_LENGTH) return 1;
+  tenant_t *tenant = server_find(server, name);
+  if (!tenant) {
+    if (server->count == server->capacity) {
+      size_t capacity = server->capacity ? server->capacity * 2 : 4;
+      tenant_t *tenants = (tenant_t *) realloc(server->tenants, capacity * sizeof(tenant_t));
+      if (!tenants) return 1;
+      server->tenants = tenants;
+      server->capacity = capacity;
+    }
+    tenant = &server->tenants[server->count++];
+    memset(tenant, 0, sizeof(tenant_t));
+    strcpy(tenant->name, name);
+  }
+  server_evict(server, tenant);
+  free(tenant->path);
+  tenant->path = strdup(path);
+  return tenant->path == NULL;
+}
+
+/** Prints the memory used by the server, and by each of its graphs. */
+void server_print_stats(const server_t *server, FILE *out) {
+  fprintf(out, "resident %zu workspace %zu\n", server->resident, workspace_bytes(&server->workspace));
+  for (size_t i = 0; i < server->count; i++) {
+    const tenant_t *tenant = &server->tenants[i];
+    fprintf(out, "graph %s %s bytes %zu queries %zu loads %zu\n", tenant->name,
+            tenant->loaded ? "loaded" : "evicted", tenant->bytes, tenant->queries, tenant->loads);
+  }
+}
+
+/**
+ * Answers a distance query on a graph of the server.
+ * @param budget the resources the query may use, or NULL if they are not limited.
+ * @param out where the answer is printed, or NULL if it is discarded.
+ * @return the distance between both cities, IMPOSSIBLE if they're not connected or the query is not valid, or BOUNDED
+ * if the query ran out of budget.
+ */
+int server_query(server_t *server, const char *name, uint64_t from, uint64_t until, const budget_t *budget,
+                 FILE *out) {
+  tenant_t *tenant = server_find(server, name);
+  phases_t phases = {0};
+  uint64_t started = now_ns();
+  if (!tenant || server_acquire(server, tenant)) {
+    if (out) fprintf(out, "error %s is not available\n", name);
+    return IMPOSSIBLE;
+  }
+  if (from >= tenant->graph.size || until >= tenant->graph.size) {
+    if (out) {
+      fprintf(out, "error %s has no city %llu\n", name, (unsigned long long) (from >= tenant->graph.size ? from : until));
+    }
+    return IMPOSSIBLE;
+  }
+  workload_query(server->recorder, tenant - server->tenants, from, until);
+  // The distances to the hub bound the answers of the queries which run out of budget.
+  engine_t engine = tenant->labels.lists ? ENGINE_LABELS : ENGINE_BFS;
+  if (budget && engine == ENGINE_BFS && !tenant->graph.hub_distances) server_index(server, tenant, false);
+  phases.load = now_ns() - started;
+  started = now_ns();
+  int result = engine == ENGINE_LABELS ? labels_query(&tenant->labels, from, until)
+                                       : solve_within(&tenant->graph, &server->workspace, from, until, budget);
+  phases.solve = now_ns() - started;
+  metrics_record(&server->metrics, engine, outcome_of(result), phases.solve);
+  slow_log_record(&server->slow_log, name, engine, from, until, result, &phases,
+                  engine == ENGINE_LABELS ? &untraced : &server->workspace.trace);
+  tracer_span("query", getpid(), 0, started, started + phases.solve, NULL);
+  tenant->queries++;
+  if (out) {
+    char answer[32];
+    format_result(answer, sizeof(answer), result, &server->workspace.bounds);
+    fprintf(out, "%s %llu %llu %s\n", name, (unsigned long long) from, (unsigned long long) until, answer);
+  }
+  return result;
+}
+
+/**
+ * Builds the distance labels of a graph of the server, with which its queries are then answered.
+ * @return 0, or 1 if an error occurred.
+ */
+int server_label(server_t *server, const char *name, FILE *out) {
+  tenant_t *tenant = server_find(server, name);
+  if (!tenant || server_acquire(server, tenant)) {
+    fprintf(out, "error %s is not available\n", name);
+    return 1;
+  }
+  uint64_t started = now_ns();
+  labels_free(&tenant->labels);
+  int error = labels_build(&tenant->labels, &tenant->graph, 0);
+  tracer_span("label", getpid(), 0, started, now_ns(), NULL);
+  server_account(server, tenant);
+  if (error) fprintf(out, "error could not label %s\n", name);
+  else fprintf(out, "labelled %s entries %zu\n", name, tenant->labels.entries);
+  return error;
+}
+
+/**
+ * Starts the compaction of the snapshot of a loaded graph with its delta log, unless one already runs.
+ * @return 0, or 1 if an error occurred.
+ */
+int tenant_compact(tenant_t *tenant) {
+  if (!tenant->log || tenant->compaction.pid || tenant->graph.layout != GRAPH_LAYOUT_CSR) return 1;
+  uint64_t started = now_ns();
+  int error = compaction_start(&tenant->compaction, &tenant->graph, tenant->path, tenant->log, tenant->logged);
+  tracer_span("compact", getpid(), 0, started, now_ns(), NULL);
+  return error;
+}
+
+/**
+ * Completes the compactions whose child process exited.
+ * @param wait whether to wait for the compactions which still run.
+ * @param out where the compactions which failed are reported, or NULL.
+ */
+void server_reap(server_t *server, bool wait, FILE *out) {
+  for (size_t i = 0; i < server->count; i++) {
+    tenant_t *tenant = &server->tenants[i];
+    if (!tenant->compaction.pid) continue;
+    // The graph may have been registered with another snapshot since the compaction started.
+    bool same = tenant->log && strcmp(tenant->path, tenant->compaction.path) == 0;
+    size_t roads = tenant->compaction.roads;
+    if (compaction_finish(&tenant->compaction, wait, same ? &tenant->log : NULL)) {
+      if (out) fprintf(out, "error could not compact %s\n", tenant->name);
+    } else if (same && !tenant->compaction.pid) {
+      tenant->logged -= roads;
+    }
+  }
+}
+
+/**
+ * Adds a road between two cities of a graph of the server, or an airport to a city when the other end is the hub, and
+ * updates its labels. The road is first appended to the delta log of the graph if the server keeps one, and the log is
+ * compacted once it holds many roads. Otherwise, the graph keeps its change until it is unloaded.
+ * @return 0, or 1 if an error occurred.
+ */
+int server_add_road(server_t *server, const char *name, uint64_t from, uint64_t to, FILE *out) {
+  tenant_t *tenant = server_find(server, name);
+  if (!tenant || server_acquire(server, tenant)) {
+    if (out) fprintf(out, "error %s is not available\n", name);
+    return 1;
+  }
+  if (from >= tenant->graph.size || to >= tenant->graph.size) {
+    if (out) {
+      fprintf(out, "error %s has no city %llu\n", name, (unsigned long long) (from >= tenant->graph.size ? from : to));
+    }
+    return 1;
+  }
+  workload_road(server->recorder, tenant - server->tenants, from, to);
+  uint64_t started = now_ns();
+  int error = tenant->log && delta_log_append(tenant->log, from, to);
+  if (!error) error = graph_add_road(&tenant->graph, from, to);
+  if (!error && tenant->log) tenant->logged++;
+  else if (!error) tenant->changed = true;
+  if (!error && tenant->logged >= DELTA_LOG_COMPACT_ROADS && !tenant->compaction.pid) tenant_compact(tenant);
+  if (!error && tenant->labels.lists) error = labels_add_road(&tenant->labels, &tenant->graph, from, to);
+  // Labels which missed a change would give wrong distances, so the queries go back to searches.
+  if (error) labels_free(&tenant->labels);
+  tracer_span("update", getpid(), 0, started, now_ns(), NULL);
+  server_account(server, tenant);
+  if (!out) return error;
+  if (error) fprintf(out, "error could not change %s\n", name);
+  else if (from == 0 || to == 0) fprintf(out, "airport %s %llu\n", name, (unsigned long long) (from ? from : to));
+  else fprintf(out, "road %s %llu %llu\n", name, (unsigned long long) from, (unsigned long long) to);
+  return error;
+}
+
+/** Unloads all the graphs of a server, and releases its memory. */
+void server_close(server_t *server) {
+  if (server->metrics_path) metrics_export(&server->metrics, server->metrics_path);
+  server_reap(server, true, NULL);
+  for (size_t i = 0; i < server->count; i++) {
+    server_evict(server, &server->tenants[i]);
+    free(server->tenants[i].path);
+  }
+  free(server->tenants);
+  memory_free(server->pending);
+  workspace_free(&server->workspace);
+}
+
+// The cost of a query whose graph is not loaded, which is answered after the queries of the loaded graphs.
+#define SCHEDULE_UNLOADED_COST UINT64_MAX
+
+/**
+ * Orders pending queries by lane, then by expected cost, then by arrival. The queries whose graph is not loaded are
+ * grouped by graph, so each graph is loaded once for all of them.
+ */
+int pending_query_compare(const void *a, const void *b) {
+  const pending_query_t *left = (const pending_query_t *) a, *right = (const pending_query_t *) b;
+  if (left->lane != right->lane) return left->lane < right->lane ? -1 : 1;
+  if (left->cost != right->cost) return left->cost < right->cost ? -1 : 1;
+  int names = left->cost == SCHEDULE_UNLOADED_COST ? strcmp(left->name, right->name) : 0;
+  if (names != 0) return names;
+  return left->arrival < right->arrival ? -1 : left->arrival > right->arrival;
+}
+
+/**
+ * Queues a query until the pending queries are dispatched. If its graph is loaded, it is indexed, so the cost of the
+ * query can be estimated from the components of the graph, the degree of the source, and the distances to the hub.
+ * The graphs are not loaded here, since loading one may evict the graph of another pending query.
+ * @return 0, or 1 if an error occurred.
+ */
+int server_schedule(server_t *server, const char *name, uint64_t from, uint64_t until, const budget_t *budget,
+                    unsigned lane) {
+  if (!server->pending) {
+    server->pending = (pending_query_t *) memory_alloc(MEMORY_BATCHES, SCHEDULE_WINDOW * sizeof(pending_query_t), false);
+    if (!server->pending) return 1;
+  }
+  pending_query_t *query = &server->pending[server->pending_count];
+  strcpy(query->name, name);
+  query->from = from;
+  query->until = until;
+  query->budgeted = budget != NULL;
+  if (budget) query->budget = *budget;
+  query->lane = lane < SCHEDULE_LANES ? lane : SCHEDULE_LANES - 1;
+  query->cost = 0; // Invalid queries are cheap, since they're answered with an error.
+  query->arrival = server->pending_count++;
+  tenant_t *tenant = server_find(server, name);
+  if (tenant && !tenant->loaded) {
+    query->cost = SCHEDULE_UNLOADED_COST;
+  } else if (tenant && from < tenant->graph.size && until < tenant->graph.size) {
+    if (!tenant->graph.components) server_index(server, tenant, true);
+    query->cost = graph_estimate(&tenant->graph, from, until);
+  }
+  return 0;
+}
+
+/** Answers the pending queries, from the cheapest to the most expensive of each lane. */
+void server_dispatch(server_t *server, FILE *out) {
+  if (server->pending_count == 0) return;
+  qsort(server->pending, server->pending_count, sizeof(pending_query_t), pending_query_compare);
+  for (size_t i = 0; i < server->pending_count; i++) {
+    pending_query_t *query = &server->pending[i];
+    server_query(server, query->name, query->from, query->until, query->budgeted ? &query->budget : NULL, out);
+  }
+  server->pending_count = 0;
+}
+
+/**
+ * Reads the lines of a file descriptor, and tells whether more lines are available without waiting for them.
+ */
+typedef struct line_reader {
+  int fd;
+  bool eof;
+  size_t start;
+  size_t end;
+  char buffer[SERVER_LINE_LENGTH * 16];
+} line_reader_t;
+
+/**
+ * Reads the next line of the input, which is truncated like fgets does if it does not fit.
+ * @param block whether to wait until a line is available.
+ * @return 1 if a line was read, 0 if no line is available without waiting, or -1 at the end of the input.
+ */
+int line_reader_next(line_reader_t *reader, char *line, size_t capacity, bool block) {
+  while (true) {
+    size_t available = reader->end - reader->start;
+    char *newline = (char *) memchr(reader->buffer + reader->start, '\n', available);
+    if (newline || available >= capacity - 1 || (reader->eof && available > 0)) {
+      size_t length = newline ? (size_t) (newline - reader->buffer - reader->start) + 1 : available;
+      if (length > capacity - 1) length = capacity - 1;
+      memcpy(line, reader->buffer + reader->start, length);
+      line[length] = '\0';
+      reader->start += length;
+      return 1;
+    }
+    if (reader->eof) return -1;
+    struct pollfd ready = {reader->fd, POLLIN, 0};
+    if (!block && poll(&ready, 1, 0) <= 0) return 0;
+    memmove(reader->buffer, reader->buffer + reader->start, available);
+    reader->start = 0;
+    reader->end = available;
+    ssize_t count = read(reader->fd, reader->buffer + reader->end, sizeof(reader->buffer) - reader->end);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) reader->eof = true;
+    else reader->end += count;
+  }
+}
+
+/**
+ * Runs a server which reads commands from its input, one per line, and answers each of them on its output:
+ * - load NAME PATH registers the snapshot of a graph under a name.
+ * - unload NAME evicts a graph from memory.
+ * - query NAME FROM UNTIL [budget_us=N] [budget_edges=N] [priority=N] prints the distance between two cities of a
+ *   graph. A query which runs out of budget prints bounds on the distance instead. When the server schedules its
+ *   queries, the queries which are ready are answered by priority lane, then by expected cost, and the answers may
+ *   come out of order.
+ * - label NAME builds the distance labels of a graph, which then answer its queries without searches.
+ * - road NAME A B adds a road between two cities of a graph, and airport NAME CITY adds an airport to a city. The
+ *   labels of the graph are updated. If the server keeps delta logs, the change is appended to the log next to the
+ *   snapshot of the graph and added again whenever the snapshot is loaded, otherwise the graph keeps its changes in
+ *   memory until it is unloaded.
+ * - compact NAME writes a new snapshot of a graph with the changes of its delta log in the background, and then
+ *   removes them from the log.
+ * - stats prints the memory used by each graph.
+ * - memory prints the memory used by each structure, and the page faults of each phase.
+ * - metrics prints the latencies of the queries, in the Prometheus text format.
+ * - quit stops the server.
+ * The metrics are also regularly exported to the metrics file of the server, if it has one.
+ * @return the exit code of the process.
+ */
+int serve(server_t *server, FILE *in, FILE *out) {
+  line_reader_t reader = {.fd = fileno(in)};
+  char line[SERVER_LINE_LENGTH];
+  char name[TENANT_NAME_LENGTH];
+  char path[SERVER_LINE_LENGTH];
+  while (true) {
+    // The scheduled queries are dispatched once the input has no more lines ready, or their window is full.
+    int status = line_reader_next(&reader, line, sizeof(line), server->pending_count == 0);
+    if (status == 0) {
+      server_dispatch(server, out);
+      fflush(out);
+      continue;
+    }
+    if (status < 0) break;
+    unsigned long long from, until;
+    int consumed = 0;
+    if (sscanf(line, "query %63s %llu %llu%n", name, &from, &until, &consumed) == 3) {
+      unsigned long long time = server->budget_time / 1000, edges = server->budget_edges, value;
+      unsigned lane = SCHEDULE_LANES / 2;
+      for (char *token = strtok(line + consumed, " \t\n"); token; token = strtok(NULL, " \t\n")) {
+        if (sscanf(token, "budget_us=%llu", &value) == 1) time = value;
+        else if (sscanf(token, "budget_edges=%llu", &value) == 1) edges = value;
+        else if (sscanf(token, "priority=%llu", &value) == 1) lane = value;
+      }
+      budget_t budget = {time ? now_ns() + time * 1000 : 0, edges};
+      if (!server->schedule) {
+        server_query(server, name, from, until, time || edges ? &budget : NULL, out);
+      } else if (server_schedule(server, name, from, until, time || edges ? &budget : NULL, lane)) {
+        fprintf(out, "error could not schedule the query\n");
+      } else if (server->pending_count < SCHEDULE_WINDOW) {
+        continue;
+      } else {
+        server_dispatch(server, out);
+      }
+    } else {
+      // The other commands change the graphs, so the queries which arrived before them are answered first.
+      server_dispatch(server, out);
+      if (sscanf(line, "load %63s %4095s", name, path) == 2) {
+        if (server_register(server, name, path)) {
+          fprintf(out, "error could not register %s\n", name);
+        } else {
+          workload_load(server->recorder, server_find(server, name) - server->tenants, name, path);
+          fprintf(out, "loaded %s\n", name);
+        }
+      } else if (sscanf(line, "unload %63s", name) == 1) {
+        tenant_t *tenant = server_find(server, name);
+        if (tenant) {
+          workload_unload(server->recorder, tenant - server->tenants);
+          server_evict(server, tenant);
+        }
+        fprintf(out, "unloaded %s\n", name);
+      } else if (sscanf(line, "label %63s", name) == 1) {
+        server_label(server, name, out);
+      } else if (sscanf(line, "road %63s %llu %llu", name, &from, &until) == 3) {
+        server_add_road(server, name, from, until, out);
+      } else if (sscanf(line, "airport %63s %llu", name, &from) == 2) {
+        server_add_road(server, name, from, 0, out);
+      } else if (sscanf(line, "compact %63s", name) == 1) {
+        tenant_t *tenant = server_find(server, name);
+        if (!tenant || server_acquire(server, tenant)) {
+          fprintf(out, "error %s is not available\n", name);
+        } else if (tenant_compact(tenant)) {
+          fprintf(out, "error could not compact %s\n", name);
+        } else {
+          fprintf(out, "compacting %s roads %zu\n", name, tenant->logged);
+        }
+      } else if (strncmp(line, "stats", 5) == 0) {
+        server_print_stats(server, out);
+      } else if (strncmp(line, "memory", 6) == 0) {
+        memory_report(out);
+      } else if (strncmp(line, "metrics", 7) == 0) {
+        metrics_write(&server->metrics, out);
+      } else if (strncmp(line, "quit", 4) == 0) {
+        break;
+      } else if (line[0] != '\n') {
+        fprintf(out, "error unknown command\n");
+      }
+    }
+    server_reap(server, false, out);
+    fflush(out);
+    if (server->metrics_path && now_ns() - server->exported >= METRICS_EXPORT_INTERVAL_NS) {
+      metrics_export(&server->metrics, server->metrics_path);
+      server->exported = now_ns();
+    }
+  }
+  server_dispatch(server, out);
+  fflush(out);
+  server_close(server);
+  return 0;
+}
+
+#define MAX_SHARDS 64
+
+/** The messages which the coordinator of a sharded search sends to its shards. */
+typedef enum shard_message {
+  SHARD_QUERY,
+  SHARD_FRONTIER,
+  SHARD_STOP,
+} shard_message_t;
+
+/** Writes or reads a whole block of bytes on a socket, and returns 1 if this was not possible. */
+static int send_block(int fd, const void *data, size_t bytes) {
+  const char *ptr = (const char *) data;
+  while (bytes > 0) {
+    ssize_t written = write(fd, ptr, bytes);
+    if (written <= 0) return 1;
+    ptr += written;
+    bytes -= written;
+  }
+  return 0;
+}
+
+static int receive_block(int fd, void *data, size_t bytes) {
+  char *ptr = (char *) data;
+  while (bytes > 0) {
+    ssize_t read_bytes = read(fd, ptr, bytes);
+    if (read_bytes <= 0) return 1;
+    ptr += read_bytes;
+    bytes -= read_bytes;
+  }
+  return 0;
+}
+
+// The airport hub is linked to every airport, so it is replicated in every part rather than owned by one of them.
+#define OWNER_REPLICATED UINT8_MAX
+
+#define PARTITION_IMBALANCE 0.03
+#define PARTITION_ROUNDS 16
+
+/**
+ * Assigns each city of a graph to a part, by splitting the cities in ranges of consecutive identifiers.
+ * @param owners the part of each city.
+ */
+void partition_ranges(const graph_t *graph, size_t parts, uint8_t *owners) {
+  owners[0] = OWNER_REPLICATED;
+  for (size_t city = 1; city < graph->size; city++) {
+    owners[city] = (uint8_t) ((city - 1) * parts / (graph->size - 1));
+  }
+}
+
+/**
+ * Assigns each city of a graph to a part, by splitting the order in which a breadth-first search over the roads visits
+ * the cities in ranges. Since road networks are mostly planar, this gives compact bands of cities.
+ * @param owners the part of each city.
+ * @return 0, or 1 if an error occurred.
+ */
+int partition_bands(const graph_t *graph, size_t parts, uint8_t *owners) {
+  city_t *order = (city_t *) malloc(graph->size * sizeof(city_t));
+  bool *visited = (bool *) calloc(graph->size, sizeof(bool));
+  if (!order || !visited) {
+    free(order);
+    free(visited);
+    return 1;
+  }
+  // The order of the search doubles as its queue.
+  size_t head = 0, tail = 0;
+  for (size_t root = 1; root < graph->size; root++) {
+    if (visited[root]) continue;
+    visited[root] = true;
+    order[tail++] = root;
+    while (head < tail) {
+      neighbour_iterator_t it;
+      city_t neighbour;
+      graph_neighbours(graph, order[head++], &it);
+      while (neighbour_iterator_next(graph, &it, &neighbour)) {
+        if (neighbour != 0 && !visited[neighbour]) {
+          visited[neighbour] = true;
+          order[tail++] = neighbour;
+        }
+      }
+    }
+  }
+  owners[0] = OWNER_REPLICATED;
+  for (size_t i = 0; i < tail; i++) owners[order[i]] = (uint8_t) (i * parts / tail);
+  free(order);
+  free(visited);
+  return 0;
+}
+
+/**
+ * Assigns each city of a graph to a part with size-constrained label propagation. Starting from bands of cities,
+ * each city repeatedly moves to the part which contains most of its neighbours, as long as that part is not full. The
+ * routes to the airport hub are ignored, since the hub is replicated in every part.
+ * @param owners the part of each city.
+ * @return 0, or 1 if an error occurred.
+ */
+int partition_propagation(const graph_t *graph, size_t parts, uint8_t *owners) {
+  if (partition_bands(graph, parts, owners)) return 1;
+  if (graph->size <= 1) return 0;
+  size_t sizes[MAX_SHARDS] = {0};
+  size_t counts[MAX_SHARDS];
+  size_t capacity = (size_t) ((graph->size - 1) * (1 + PARTITION_IMBALANCE) / parts) + 1;
+  for (size_t city = 1; city < graph->size; city++) sizes[owners[city]]++;
+
+  for (int round = 0; round < PARTITION_ROUNDS; round++) {
+    size_t moves = 0;
+    for (size_t city = 1; city < graph->size; city++) {
+      memset(counts, 0, parts * sizeof(size_t));
+      neighbour_iterator_t it;
+      city_t neighbour;
+      graph_neighbours(graph, city, &it);
+      while (neighbour_iterator_next(graph, &it, &neighbour)) {
+        if (owners[neighbour] != OWNER_REPLICATED) counts[owners[neighbour]]++;
+      }
+      uint8_t current = owners[city], best = current;
+      for (size_t part = 0; part < parts; part++) {
+        if (counts[part] > counts[best] && sizes[part] < capacity) best = (uint8_t) part;
+      }
+      if (best != current) {
+        sizes[current]--;
+        sizes[best]++;
+        owners[city] = best;
+        moves++;
+      }
+    }
+    if (moves * 1000 < graph->size) break;
+  }
+  return 0;
+}
+
+/** Returns the number of roads whose cities belong to different parts. */
+size_t partition_cut(const graph_t *graph, const uint8_t *owners) {
+  size_t cut = 0;
+  for (size_t city = 1; city < graph->size; city++) {
+    neighbour_iterator_t it;
+    city_t neighbour;
+    graph_neighbours(graph, city, &it);
+    while (neighbour_iterator_next(graph, &it, &neighbour)) {
+      if (neighbour > city && owners[neighbour] != OWNER_REPLICATED && owners[neighbour] != owners[city]) cut++;
+    }
+  }
+  return cut;
+}
+
+#define PARTITION_MAGIC "EX2P"
+#define PARTITION_VERSION 1
+#define PARTITION_READ_CITIES 8192
+
+/**
+ * The header of the file of a part. It is followed by the global identifier of each local city, the offsets and the
+ * neighbours of the local cities, and the global identifier and the owner of each ghost city. The neighbours use local
+ * identifiers, where the ghost cities, which are owned by other parts, are numbered after the local ones. The airport
+ * hub is the first local city of every part, and only links to the airports of the part.
+ */
+typedef struct partition_header {
+  char magic[4];
+  uint32_t version;
+  uint8_t city_bytes;
+  uint8_t offset_bytes;
+  uint8_t part;
+  uint8_t parts;
+  uint8_t reserved[4];
+  uint64_t cities;
+  uint64_t ghosts;
+  uint64_t entries;
+} partition_header_t;
+
+/**
+ * Writes the file of each part of a graph, named PREFIX.INDEX.
+ * @return 0, or 1 if an error occurred.
+ */
+int partition_write(const graph_t *graph, size_t parts, const uint8_t *owners, const char *prefix) {
+  city_t *locals = (city_t *) malloc(graph->size * sizeof(city_t));
+  city_t *globals = (city_t *) malloc(graph->size * sizeof(city_t));
+  offset_t *start = (offset_t *) malloc((graph->size + 1) * sizeof(offset_t));
+  city_t *neighbours = (city_t *) malloc(graph_start(graph, graph->size) * sizeof(city_t) + 1);
+  city_t *ghosts = (city_t *) malloc(graph->size * sizeof(city_t));
+  uint8_t *ghost_owners = (uint8_t *) malloc(graph->size * sizeof(uint8_t));
+  char *path = (char *) malloc(strlen(prefix) + 8);
+  int error = !locals || !globals || !start || !neighbours || !ghosts || !ghost_owners || !path;
+  const city_t unassigned = (city_t) -1;
+  if (!error) for (size_t city = 0; city < graph->size; city++) locals[city] = unassigned;
+
+  for (size_t part = 0; part < parts && !error; part++) {
+    partition_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PARTITION_MAGIC, 4);
+    header.version = PARTITION_VERSION;
+    header.city_bytes = sizeof(city_t);
+    header.offset_bytes = sizeof(offset_t);
+    header.part = part;
+    header.parts = parts;
+    for (size_t city = 0; city < graph->size; city++) {
+      if (owners[city] == part || owners[city] == OWNER_REPLICATED) {
+        locals[city] = header.cities;
+        globals[header.cities++] = city;
+      }
+    }
+    for (size_t local = 0; local < header.cities; local++) {
+      city_t city = globals[local];
+      start[local] = header.entries;
+      neighbour_iterator_t it;
+      city_t neighbour;
+      graph_neighbours(graph, city, &it);
+      while (neighbour_iterator_next(graph, &it, &neighbour)) {
+        if (owners[city] == OWNER_REPLICATED && owners[neighbour] != part) continue;
+        if (locals[neighbour] == unassigned) {
+          locals[neighbour] = header.cities + header.ghosts;
+          ghost_owners[header.ghosts] = owners[neighbour];
+          ghosts[header.ghosts++] = neighbour;
+        }
+        neighbours[header.entries++] = locals[neighbour];
+      }
+    }
+    start[header.cities] = header.entries;
+
+    sprintf(path, "%s.%zu", prefix, part);
+    FILE *file = fopen(path, "wb");
+    error = !file || write_block(file, &header, sizeof(header)) ||
+        write_block(file, globals, header.cities * sizeof(city_t)) ||
+        write_block(file, start, (header.cities + 1) * sizeof(offset_t)) ||
+        write_block(file, neighbours, header.entries * sizeof(city_t)) ||
+        write_block(file, ghosts, header.ghosts * sizeof(city_t)) ||
+        write_block(file, ghost_owners, header.ghosts * sizeof(uint8_t));
+    if (file) error |= fclose(file) != 0;
+
+    for (size_t local = 0; local < header.cities; local++) locals[globals[local]] = unassigned;
+    for (size_t ghost = 0; ghost < header.ghosts; ghost++) locals[ghosts[ghost]] = unassigned;
+  }
+  free(locals);
+  free(globals);
+  free(start);
+  free(neighbours);
+  free(ghosts);
+  free(ghost_owners);
+  free(path);
+  return error;
+}
+
+/**
+ * The part of a graph which is owned by a shard process, as written by partition_write. The cities of the shard are
+ * numbered locally, in the order of their global identifiers, and their neighbours which are owned by other shards
+ * are ghost cities, numbered after the local ones. Every shard has a replica of the airport hub, which is its first
+ * local city and only links to the airports of the shard.
+ */
+typedef struct shard_graph {
+
+  /** The index of this shard. */
+  uint8_t index;
+
+  /** The number of cities owned by the shard, and the number of ghost cities. */
+  size_t count;
+  size_t ghost_count;
+
+  /** The global identifier of each local city, by increasing identifier. */
+  city_t *cities;
+
+  /** The offsets of the adjacency lists of the local cities. */
+  offset_t *start;
+
+  /** The local identifiers of the neighbours of the local cities. */
+  city_t *neighbours;
+
+  /** The global identifier of each ghost city. */
+  city_t *ghosts;
+
+  /** Whether each local city was already visited by the current query. */
+  bool *visited;
+
+  /** The local cities which are expanded in the current round. */
+  city_t *frontier;
+
+  /** The local cities which will be expanded in the next round. */
+  city_t *next;
+
+  /** The number of local cities which will be expanded in the next round. */
+  size_t next_count;
+} shard_graph_t;
+
+/**
+ * Reads the header of the file of a part, and checks that it was written by this build for the provided part.
+ * @return 0, or 1 if the header could not be read or does not match.
+ */
+static int partition_header_read(int fd, partition_header_t *header, size_t part, size_t parts) {
+  return pread(fd, header, sizeof(partition_header_t), 0) != sizeof(partition_header_t) ||
+      memcmp(header->magic, PARTITION_MAGIC, 4) || header->version != PARTITION_VERSION ||
+      header->city_bytes != sizeof(city_t) || header->offset_bytes != sizeof(offset_t) || header->part != part ||
+      header->parts != parts;
+}
+
+/**
+ * Loads the part of a graph which is owned by a shard from its file. The owners of the ghost cities are not read,
+ * since the coordinator routes the cities to their shard.
+ * @return 0, or 1 if an error occurred.
+ */
+int shard_graph_load(shard_graph_t *shard, FILE *file, uint8_t index, size_t parts) {
+  memset(shard, 0, sizeof(shard_graph_t));
+  shard->index = index;
+  partition_header_t header;
+  if (partition_header_read(fileno(file), &header, index, parts)) return 1;
+  shard->count = header.cities;
+  shard->ghost_count = header.ghosts;
+  shard->cities = (city_t *) malloc(shard->count * sizeof(city_t) + 1);
+  shard->start = (offset_t *) malloc((shard->count + 1) * sizeof(offset_t));
+  shard->neighbours = (city_t *) malloc(header.entries * sizeof(city_t) + 1);
+  shard->ghosts = (city_t *) malloc(shard->ghost_count * sizeof(city_t) + 1);
+  shard->visited = (bool *) calloc(shard->count + 1, sizeof(bool));
+  shard->frontier = (city_t *) malloc(shard->count * sizeof(city_t) + 1);
+  shard->next = (city_t *) malloc(shard->count * sizeof(city_t) + 1);
+  if (!shard->cities || !shard->start || !shard->neighbours || !shard->ghosts || !shard->visited || !shard->frontier ||
+      !shard->next) {
+    return 1;
+  }
+  return fseek(file, sizeof(header), SEEK_SET) || read_block(file, shard->cities, shard->count * sizeof(city_t)) ||
+      read_block(file, shard->start, (shard->count + 1) * sizeof(offset_t)) ||
+      read_block(file, shard->neighbours, header.entries * sizeof(city_t)) ||
+      read_block(file, shard->ghosts, shard->ghost_count * sizeof(city_t));
+}
+
+/** Returns the local identifier of a city which is owned by a shard, or replicated in it. */
+static city_t shard_graph_local(const shard_graph_t *shard, city_t city) {
+  size_t low = 0, high = shard->count;
+  while (high - low > 1) {
+    size_t middle = low + (high - low) / 2;
+    if (shard->cities[middle] <= city) low = middle;
+    else high = middle;
+  }
+  return low;
+}
+
+/**
+ * Runs the loop of a shard process. Each round, the shard receives the cities of the frontier which it owns, keeps
+ * the ones which it did not visit yet, and expands them. The neighbours which it owns are kept for the next round, and
+ * the others are sent back to the coordinator. The first time the airport hub is reached, it is also sent to the
+ * coordinator, so its replicas in the other shards are expanded in the next round.
+ */
+void shard_run(shard_graph_t *shard, int fd) {
+  city_list_t incoming = {0}, outgoing = {0};
+  uint64_t until = 0;
+  for (;;) {
+    uint64_t header[2];
+    if (receive_block(fd, header, sizeof(header))) return;
+    if (header[0] == SHARD_STOP) return;
+    if (city_list_reserve(&incoming, header[1]) || receive_block(fd, incoming.items, header[1] * sizeof(uint64_t))) {
+      return;
+    }
+    incoming.size = header[1];
+    if (header[0] == SHARD_QUERY) {
+      until = incoming.items[0];
+      memset(shard->visited, 0, shard->count * sizeof(bool));
+      shard->next_count = 0;
+      continue;
+    }
+
+    // The frontier is made of the cities found locally in the previous round, and the new remote cities.
+    uint64_t started = now_ns();
+    city_t *swap = shard->frontier;
+    shard->frontier = shard->next;
+    shard->next = swap;
+    size_t frontier = shard->next_count;
+    for (size_t i = 0; i < incoming.size; i++) {
+      city_t local = shard_graph_local(shard, incoming.items[i]);
+      if (!shard->visited[local]) {
+        shard->visited[local] = true;
+        shard->frontier[frontier++] = local;
+      }
+    }
+    uint64_t found = 0, edges = 0;
+    shard->next_count = 0;
+    outgoing.size = 0;
+    for (size_t i = 0; i < frontier; i++) {
+      city_t local = shard->frontier[i];
+      if (shard->cities[local] == until) found = 1;
+      edges += shard->start[local + 1] - shard->start[local];
+      for (offset_t j = shard->start[local]; j < shard->start[local + 1]; j++) {
+        city_t neighbour = shard->neighbours[j];
+        if (neighbour >= shard->count) {
+          if (city_list_push(&outgoing, shard->ghosts[neighbour - shard->count])) return;
+        } else if (!shard->visited[neighbour]) {
+          shard->visited[neighbour] = true;
+          shard->next[shard->next_count++] = neighbour;
+          // The hub is the first local city of every shard.
+          if (neighbour == 0 && city_list_push(&outgoing, 0)) return;
+        }
+      }
+    }
+
+    uint64_t reply[7] = {found, shard->next_count, outgoing.size, frontier, edges, started, now_ns()};
+    if (send_block(fd, reply, sizeof(reply)) ||
+        send_block(fd, outgoing.items, outgoing.size * sizeof(uint64_t))) {
+      return;
+    }
+  }
+}
+
+/**
+ * A set of shard processes, each of which owns a part of a graph.
+ */
+typedef struct shard_pool {
+
+  /** The number of shards. */
+  size_t count;
+
+  /** The shard which owns each city of the graph. */
+  uint8_t *owners;
+
+  /** The process of each shard. */
+  pid_t pids[MAX_SHARDS];
+
+  /** The socket connected to each shard. */
+  int sockets[MAX_SHARDS];
+
+  /** The cities which will be sent to each shard in the next round. */
+  city_list_t inboxes[MAX_SHARDS];
+
+  /** The cities which were last received from a shard. */
+  city_list_t received;
+
+  /** The trace of the last query, where the frontier of a level counts the replicas of the hub once per shard. */
+  bfs_trace_t trace;
+} shard_pool_t;
+
+/**
+ * Reads which shard owns each city from the cities listed in the files of the parts, without their roads.
+ * @param files the file of each part.
+ * @param size the number of cities of the graph, including the hub.
+ * @return 0, or 1 if an error occurred or if the parts don't cover the cities of the graph exactly.
+ */
+static int shard_pool_owners(shard_pool_t *pool, const int *files, size_t size) {
+  pool->owners = (uint8_t *) malloc(size * sizeof(uint8_t) + 1);
+  city_t *cities = (city_t *) malloc(PARTITION_READ_CITIES * sizeof(city_t));
+  int error = !pool->owners || !cities;
+  size_t owned = 0;
+  for (size_t i = 0; i < pool->count && !error; i++) {
+    partition_header_t header;
+    error = partition_header_read(files[i], &header, i, pool->count) || header.cities == 0;
+    // The hub is listed by every part, so it is only counted once.
+    if (!error) owned += header.cities - 1;
+    for (uint64_t read = 0; read < header.cities && !error;) {
+      size_t chunk = header.cities - read < PARTITION_READ_CITIES ? header.cities - read : PARTITION_READ_CITIES;
+      off_t offset = sizeof(header) + read * sizeof(city_t);
+      error = pread(files[i], cities, chunk * sizeof(city_t), offset) != (ssize_t) (chunk * sizeof(city_t));
+      for (size_t j = 0; j < chunk && !error; j++) {
+        error = cities[j] >= size;
+        if (!error) pool->owners[cities[j]] = cities[j] == 0 ? OWNER_REPLICATED : (uint8_t) i;
+      }
+      read += chunk;
+    }
+  }
+  free(cities);
+  return error || owned + 1 != size;
+}
+
+/**
+ * Starts the shard processes, each of which loads the part of the graph which it owns from the file PREFIX.INDEX
+ * written by partition_write. The coordinator only reads which cities each part owns, and the files may be removed
+ * once this returns.
+ * @param size the number of cities of the graph, including the hub.
+ * @return 0, or 1 if an error occurred.
+ */
+int shard_pool_start(shard_pool_t *pool, const char *prefix, size_t count, size_t size) {
+  memset(pool, 0, sizeof(shard_pool_t));
+  pool->count = count;
+  int files[MAX_SHARDS];
+  char *path = (char *) malloc(strlen(prefix) + 8);
+  int error = !path;
+  size_t opened = 0;
+  for (; opened < count && !error; opened++) {
+    sprintf(path, "%s.%zu", prefix, opened);
+    files[opened] = open(path, O_RDONLY);
+    error = files[opened] < 0;
+  }
+  free(path);
+  if (error) opened--;
+  if (!error) error = shard_pool_owners(pool, files, size);
+
+  for (size_t i = 0; i < count && !error; i++) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+      error = 1;
+      break;
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      error = 1;
+      break;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      for (size_t j = 0; j < i; j++) close(pool->sockets[j]);
+      // The shard only keeps its own part, and the file of the coordinator is not shared with it anymore.
+      free(pool->owners);
+      FILE *file = fdopen(dup(files[i]), "rb");
+      for (size_t j = 0; j < opened; j++) close(files[j]);
+      shard_graph_t shard;
+      if (file && !shard_graph_load(&shard, file, i, count)) {
+        fclose(file);
+        shard_run(&shard, fds[1]);
+      }
+      _exit(0);
+    }
+    close(fds[1]);
+    pool->pids[i] = pid;
+    pool->sockets[i] = fds[0];
+    pool->count = i + 1;
+    char name[32];
+    snprintf(name, sizeof(name), "shard %zu", i);
+    tracer_name("process_name", pid, 0, name);
+  }
+  for (size_t j = 0; j < opened; j++) close(files[j]);
+  return error;
+}
+
+/**
+ * Adds a city to the inbox of the shard which owns it, or to every inbox if it is replicated.
+ * @return 0, or 1 if an error occurred.
+ */
+static int shard_pool_route(shard_pool_t *pool, uint64_t city) {
+  if (pool->owners[city] != OWNER_REPLICATED) return city_list_push(&pool->inboxes[pool->owners[city]], city);
+  for (size_t i = 0; i < pool->count; i++) {
+    if (city_list_push(&pool->inboxes[i], city)) return 1;
+  }
+  return 0;
+}
+
+/** Sends a message to a shard, and returns 1 if this was not possible. */
+static int shard_send(int fd, shard_message_t type, const uint64_t *cities, size_t count) {
+  uint64_t header[2] = {type, count};
+  return send_block(fd, header, sizeof(header)) || send_block(fd, cities, count * sizeof(uint64_t));
+}
+
+/**
+ * Runs a breadth-first search over the shards, in bulk-synchronous rounds. Each round expands one level of the search,
+ * and the cities which were found by a shard but belong to another one are routed through the coordinator.
+ * @return the distance between both cities, or IMPOSSIBLE if they're not connected.
+ */
+int shard_pool_solve(shard_pool_t *pool, city_t from, city_t until) {
+  uint64_t target = until;
+  for (size_t i = 0; i < pool->count; i++) {
+    pool->inboxes[i].size = 0;
+    if (shard_send(pool->sockets[i], SHARD_QUERY, &target, 1)) return IMPOSSIBLE;
+  }
+  if (shard_pool_route(pool, from)) return IMPOSSIBLE;
+  bfs_trace_reset(&pool->trace);
+  for (int distance = 0;; distance++) {
+    uint64_t started = tracer.file ? now_ns() : 0;
+    if (pool->trace.hub_level < 0) {
+      for (size_t i = 0; i < pool->count; i++) {
+        city_list_t *inbox = &pool->inboxes[i];
+        for (size_t j = 0; j < inbox->size; j++) {
+          if (inbox->items[j] == 0) pool->trace.hub_level = distance;
+        }
+      }
+    }
+    for (size_t i = 0; i < pool->count; i++) {
+      city_list_t *inbox = &pool->inboxes[i];
+      if (shard_send(pool->sockets[i], SHARD_FRONTIER, inbox->items, inbox->size)) return IMPOSSIBLE;
+      inbox->size = 0;
+    }
+    bool found = false;
+    size_t pending = 0;
+    uint64_t frontier = 0;
+    for (size_t i = 0; i < pool->count; i++) {
+      uint64_t reply[7];
+      if (receive_block(pool->sockets[i], reply, sizeof(reply))) return IMPOSSIBLE;
+      found |= reply[0] != 0;
+      pending += reply[1] + reply[2];
+      frontier += reply[3];
+      pool->trace.edges += reply[4];
+      if (tracer.file) {
+        char args[96];
+        snprintf(args, sizeof(args), "\"level\":%d,\"frontier\":%llu,\"edges\":%llu,\"sent\":%llu", distance,
+                 (unsigned long long) reply[3], (unsigned long long) reply[4], (unsigned long long) reply[2]);
+        tracer_span("shard round", pool->pids[i], 0, reply[5], reply[6], args);
+      }
+      if (city_list_reserve(&pool->received, reply[2]) ||
+          receive_block(pool->sockets[i], pool->received.items, reply[2] * sizeof(uint64_t))) {
+        return IMPOSSIBLE;
+      }
+      for (uint64_t j = 0; j < reply[2]; j++) {
+        if (shard_pool_route(pool, pool->received.items[j])) return IMPOSSIBLE;
+      }
+    }
+    if (frontier > 0) bfs_trace_level(&pool->trace, frontier);
+    if (tracer.file) tracer_level(distance, frontier, started);
+    if (found) return distance;
+    if (pending == 0) return IMPOSSIBLE;
+  }
+}
+
+/** Stops the shard processes, and releases the memory of the pool. */
+void shard_pool_stop(shard_pool_t *pool) {
+  for (size_t i = 0; i < pool->count; i++) {
+    shard_send(pool->sockets[i], SHARD_STOP, NULL, 0);
+    close(pool->sockets[i]);
+    waitpid(pool->pids[i], NULL, 0);
+    memory_free(pool->inboxes[i].items);
+  }
+  memory_free(pool->received.items);
+  free(pool->trace.frontiers);
+  free(pool->owners);
+  memset(pool, 0, sizeof(shard_pool_t));
+}
+
+#define MAX_THREADS 256
+#define ANF_DEFAULT_LOG_REGISTERS 6
+#define ANF_MAX_LOG_REGISTERS 12
+
+/** Returns the number of processors which are online, which is the default number of worker threads. */
+size_t default_threads() {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count < 1 ? 1 : count > MAX_THREADS ? MAX_THREADS : (size_t) count;
+}
+
+/**
+ * Returns the first city of a part of a graph, when its cities are split in consecutive ranges which hold about as
+ * many adjacency list entries each.
+ */
+size_t graph_split(const graph_t *graph, size_t parts, size_t part) {
+  if (part == 0) return 0;
+  if (part >= parts) return graph->size;
+  uint64_t target = (uint64_t) graph_start(graph, graph->size) * part / parts;
+  size_t low = 0, high = graph->size;
+  while (low < high) {
+    size_t middle = low + (high - low) / 2;
+    if (graph_start(graph, middle) < target) low = middle + 1;
+    else high = middle;
+  }
+  return low;
+}
+
+/** Mixes the bits of a city, so its HyperLogLog register and rank are uniformly distributed. */
+static inline uint64_t anf_hash(uint64_t city) {
+  uint64_t z = city + UINT64_C(0x9E3779B97F4A7C15);
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+/**
+ * The state of HyperANF, which estimates the number of cities within distance t of each city with one HyperLogLog
+ * counter per city. The counter of a city at distance t + 1 is the union of its counter and of the counters of its
+ * neighbours at distance t, so each iteration is a single pass over the adjacency lists.
+ */
+typedef struct anf {
+  const graph_t *graph;
+  unsigned log_registers;
+  size_t registers;
+
+  /** The counters of the previous and of the current iteration, with the registers of each city side by side. */
+  uint8_t *current;
+  uint8_t *next;
+
+  /** The estimated number of cities in the counter of each city, which is kept while the counter doesn't change. */
+  float *estimates;
+
+  /** The bias correction of the estimates, which depends on the number of registers. */
+  double alpha;
+
+  /** The inverse powers of two of each rank. */
+  double powers[65];
+} anf_t;
+
+/** The part of an iteration of HyperANF which runs on a worker thread. */
+typedef struct anf_worker {
+  anf_t *anf;
+  size_t index;
+  size_t first;
+  size_t last;
+
+  /** The sum of the estimated sizes of the balls of the cities of the worker. */
+  double sum;
+
+  /** Whether a counter of the worker changed during the iteration. */
+  bool changed;
+} anf_worker_t;
+
+/** Estimates the number of distinct cities which were added to a counter. */
+static double anf_estimate(const anf_t *anf, const uint8_t *counter) {
+  double sum = 0;
+  size_t zeros = 0;
+  for (size_t j = 0; j < anf->registers; j++) {
+    sum += anf->powers[counter[j]];
+    zeros += counter[j] == 0;
+  }
+  double m = (double) anf->registers;
+  double estimate = anf->alpha * m * m / sum;
+  // Small cardinalities are estimated from the number of empty registers, like linear counting.
+  if (estimate <= 2.5 * m && zeros > 0) estimate = m * log(m / zeros);
+  return estimate;
+}
+
+/** Runs the part of an iteration of a worker. */
+static void *anf_worker_run(void *argument) {
+  anf_worker_t *worker = (anf_worker_t *) argument;
+  const anf_t *anf = worker->anf;
+  size_t registers = anf->registers;
+  uint64_t started = now_ns();
+  worker->sum = 0;
+  worker->changed = false;
+  for (size_t city = worker->first; city < worker->last; city++) {
+    const uint8_t *previous = anf->current + city * registers;
+    uint8_t *counter = anf->next + city * registers;
+    memcpy(counter, previous, registers);
+    neighbour_iterator_t it;
+    city_t neighbour;
+    graph_neighbours(anf->graph, city, &it);
+    while (neighbour_iterator_next(anf->graph, &it, &neighbour)) {
+      const uint8_t *other = anf->current + (size_t) neighbour * registers;
+      for (size_t j = 0; j < registers; j++) counter[j] = counter[j] > other[j] ? counter[j] : other[j];
+    }
+    if (memcmp(counter, previous, registers) != 0) {
+      worker->changed = true;
+      anf->estimates[city] = (float) anf_estimate(anf, counter);
+    }
+    if (city != 0) worker->sum += anf->estimates[city];
+  }
+  char args[64];
+  snprintf(args, sizeof(args), "\"cities\":%zu", worker->last - worker->first);
+  tracer_span("anf worker", getpid(), worker->index + 1, started, now_ns(), args);
+  return NULL;
+}
+
+/**
+ * Estimates the neighbourhood function of a graph: the number of ordered pairs of cities within distance t of each
+ * other, for each t until it stops growing. The hub is not a city, so it only counts as a path between cities.
+ * @param log_registers the logarithm of the number of registers of each counter, which trades memory for precision.
+ * @param threads the number of worker threads of each iteration.
+ * @param out where the function, its distance distribution, the average distance and the effective diameter are
+ * printed.
+ * @return 0, or 1 if an error occurred.
+ */
+int run_anf(const graph_t *graph, unsigned log_registers, size_t threads, FILE *out) {
+  anf_t anf;
+  anf.graph = graph;
+  anf.log_registers = log_registers;
+  anf.registers = (size_t) 1 << log_registers;
+  anf.alpha = anf.registers == 16 ? 0.673 : anf.registers == 32 ? 0.697 : anf.registers == 64 ? 0.709
+                                                                            : 0.7213 / (1 + 1.079 / anf.registers);
+  anf.current = (uint8_t *) memory_alloc(MEMORY_INDEXES, graph->size * anf.registers, true);
+  anf.next = (uint8_t *) memory_alloc(MEMORY_INDEXES, graph->size * anf.registers, false);
+  anf.estimates = (float *) memory_alloc(MEMORY_INDEXES, graph->size * sizeof(float), true);
+  for (size_t rank = 0; rank < 65; rank++) anf.powers[rank] = ldexp(1.0, -(int) rank);
+  size_t capacity = 64;
+  double *function = (double *) malloc(capacity * sizeof(double));
+  if (!anf.current || !anf.next || !anf.estimates || !function) {
+    memory_free(anf.current);
+    memory_free(anf.next);
+    memory_free(anf.estimates);
+    free(function);
+    return 1;
+  }
+
+  // Each counter starts with its own city, in the register picked by the highest bits of its hash, with the rank of
+  // the first set bit of the other bits.
+  double sum = 0;
+  for (size_t city = 1; city < graph->size; city++) {
+    uint64_t hash = anf_hash(city);
+    size_t j = hash >> (64 - log_registers);
+    uint64_t rest = hash << log_registers;
+    uint8_t rank = rest ? (uint8_t) (__builtin_clzll(rest) + 1) : (uint8_t) (64 - log_registers + 1);
+    anf.current[city * anf.registers + j] = rank;
+    anf.estimates[city] = (float) anf_estimate(&anf, anf.current + city * anf.registers);
+    sum += anf.estimates[city];
+  }
+  function[0] = sum;
+
+  if (threads > graph->size) threads = graph->size ? graph->size : 1;
+  anf_worker_t workers[MAX_THREADS];
+  pthread_t handles[MAX_THREADS];
+  for (size_t i = 0; i < threads; i++) {
+    workers[i] = (anf_worker_t) {&anf, i, graph_split(graph, threads, i), graph_split(graph, threads, i + 1), 0, false};
+    char name[32];
+    snprintf(name, sizeof(name), "anf worker %zu", i);
+    tracer_name("thread_name", getpid(), i + 1, name);
+  }
+  size_t iterations = 0;
+  int error = 0;
+  bool changed = true;
+  while (changed && !error) {
+    uint64_t started = now_ns();
+    size_t spawned = 0;
+    for (; spawned < threads; spawned++) {
+      if (pthread_create(&handles[spawned], NULL, anf_worker_run, &workers[spawned])) break;
+    }
+    for (size_t i = spawned; i < threads; i++) anf_worker_run(&workers[i]); // Threads which can't be created.
+    for (size_t i = 0; i < spawned; i++) pthread_join(handles[i], NULL);
+    changed = false;
+    sum = 0;
+    for (size_t i = 0; i < threads; i++) {
+      changed = changed || workers[i].changed;
+      sum += workers[i].sum;
+    }
+    tracer_span("anf iteration", getpid(), 0, started, now_ns(), NULL);
+    uint8_t *swap = anf.current;
+    anf.current = anf.next;
+    anf.next = swap;
+    if (!changed) break;
+    if (++iterations == capacity) {
+      capacity *= 2;
+      double *grown = (double *) realloc(function, capacity * sizeof(double));
+      if (!grown) error = 1;
+      else function = grown;
+    }
+    // The estimates are not exactly monotone, but the function they estimate is.
+    function[iterations] = sum > function[iterations - 1] ? sum : function[iterations - 1];
+  }
+
+  if (!error) {
+    // The last iterations may only have changed the counter of the hub, which isn't counted.
+    while (iterations > 0 && function[iterations] == function[iterations - 1]) iterations--;
+    double pairs = function[iterations] - function[0];
+    double average = 0;
+    for (size_t t = 0; t <= iterations; t++) fprintf(out, "neighbourhood %zu %.1f\n", t, function[t]);
+    for (size_t t = 1; t <= iterations; t++) {
+      double fraction = pairs > 0 ? (function[t] - function[t - 1]) / pairs : 0;
+      average += t * fraction;
+      fprintf(out, "distance %zu %.6f\n", t, fraction);
+    }
+    // The effective diameter is the distance within which 90% of the connected pairs are, interpolated between levels.
+    double effective = 0;
+    for (size_t t = 1; t <= iterations; t++) {
+      double reached = function[t] - function[0], before = function[t - 1] - function[0];
+      if (reached >= 0.9 * pairs) {
+        effective = (t - 1) + (reached > before ? (0.9 * pairs - before) / (reached - before) : 0);
+        break;
+      }
+    }
+    fprintf(out, "pairs %.1f\naverage_distance %.4f\neffective_diameter %.4f\n", pairs, average, effective);
+  }
+  memory_free(anf.current);
+  memory_free(anf.next);
+  memory_free(anf.estimates);
+  free(function);
+  return error;
+}
+
+/** A city and its closeness centrality. */
+typedef struct closeness_entry {
+  city_t city;
+  double closeness;
+} closeness_entry_t;
+
+/** Returns whether a city ranks before another one, by decreasing closeness and then by increasing identifier. */
+static inline bool closeness_before(closeness_entry_t a, closeness_entry_t b) {
+  return a.closeness > b.closeness || (a.closeness == b.closeness && a.city < b.city);
+}
+
+/**
+ * The state shared by the workers which search for the cities with the highest closeness. The closeness of a city
+ * which reaches r other cities out of n with a sum of distances f is r * r / ((n - 1) * f), so cities in small
+ * components don't rank first.
+ */
+typedef struct closeness {
+  const graph_t *graph;
+
+  /** The cities in the order in which they are tried, ranked by their degree so the most central ones come first. */
+  closeness_entry_t *candidates;
+  size_t candidate_count;
+
+  /** The index of the next candidate which is tried, which workers take atomically. */
+  size_t next;
+
+  /** The best cities found so far, from the best to the worst. */
+  closeness_entry_t *best;
+  size_t best_count;
+  size_t k;
+
+  /** The closeness of the worst of the best cities once there are k of them, below which a candidate is pruned. */
+  double threshold;
+  pthread_mutex_t lock;
+} closeness_t;
+
+/** A worker which tries candidates with its own workspace. */
+typedef struct closeness_worker {
+  closeness_t *closeness;
+  size_t index;
+  workspace_t workspace;
+
+  /** The cities visited by the current candidate, in the order in which they were visited. */
+  city_t *order;
+
+  size_t tried;
+  size_t pruned;
+} closeness_worker_t;
+
+/** Returns the closeness of a city from the number of cities which it reaches and from the sum of their distances. */
+static inline double closeness_of(const graph_t *graph, uint64_t reached, uint64_t farness) {
+  if (farness == 0 || graph->size <= 2) return 0;
+  return (double) reached * (double) reached / ((double) (graph->size - 2) * (double) farness);
+}
+
+/** Adds a city to the best cities, if it ranks before the worst of them. */
+static void closeness_offer(closeness_t *closeness, closeness_entry_t entry) {
+  pthread_mutex_lock(&closeness->lock);
+  size_t count = closeness->best_count;
+  if (count < closeness->k || closeness_before(entry, closeness->best[count - 1])) {
+    if (count == closeness->k) count--;
+    size_t i = count;
+    for (; i > 0 && closeness_before(entry, closeness->best[i - 1]); i--) closeness->best[i] = closeness->best[i - 1];
+    closeness->best[i] = entry;
+    closeness->best_count = count + 1;
+    if (closeness->best_count == closeness->k) {
+      __atomic_store(&closeness->threshold, &closeness->best[closeness->k - 1].closeness, __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&closeness->lock);
+}
+
+/**
+ * Runs a breadth-first search from a candidate, and stops it as soon as the sum of the distances is bound to be too
+ * large for the candidate to rank among the best cities. When the cities up to distance d are known, the cities at
+ * distance d + 1 are at most the neighbours of those at distance d, except the ones they were reached from, and all
+ * the other cities are at distance d + 2 or more (Bergamini et al.).
+ */
+static void closeness_try(closeness_worker_t *worker, city_t from) {
+  const graph_t *graph = worker->closeness->graph;
+  const closeness_t *closeness = worker->closeness;
+  bool *visited = worker->workspace.visited;
+  city_t *order = worker->order;
+  uint64_t reachable = graph->component_sizes[graph->components[from]] - 1;
+  if (graph->components[from] == graph->components[0]) reachable--; // The hub isn't a city.
+
+  size_t head = 0, tail = 0;
+  order[tail++] = from;
+  visited[from] = true;
+  uint64_t reached = 0, farness = 0, level = 0;
+  bool pruned = false;
+  while (head < tail && !pruned) {
+    size_t last = tail;
+    for (; head < last; head++) {
+      neighbour_iterator_t it;
+      city_t city;
+      graph_neighbours(graph, order[head], &it);
+      while (neighbour_iterator_next(graph, &it, &city)) {
+        if (visited[city]) continue;
+        visited[city] = true;
+        order[tail++] = city;
+        if (city != 0) {
+          reached++;
+          farness += level + 1;
+        }
+      }
+    }
+    level++;
+    double threshold;
+    __atomic_load(&closeness->threshold, &threshold, __ATOMIC_RELAXED);
+    if (head == tail || threshold <= 0) continue;
+    uint64_t next = 0;
+    for (size_t i = last; i < tail; i++) next += graph_degree(graph, order[i]) - 1;
+    uint64_t remaining = reachable - reached;
+    uint64_t near = next < remaining ? next : remaining;
+    uint64_t bound = farness + (level + 1) * near + (level + 2) * (remaining - near);
+    pruned = closeness_of(graph, reachable, bound) < threshold;
+  }
+  for (size_t i = 0; i < tail; i++) visited[order[i]] = false;
+  worker->tried++;
+  if (pruned) worker->pruned++;
+  else closeness_offer(worker->closeness, (closeness_entry_t) {from, closeness_of(graph, reached, farness)});
+}
+
+/** Tries candidates until there are none left. */
+static void *closeness_worker_run(void *argument) {
+  closeness_worker_t *worker = (closeness_worker_t *) argument;
+  closeness_t *closeness = worker->closeness;
+  uint64_t started = now_ns();
+  size_t index;
+  while ((index = __atomic_fetch_add(&closeness->next, 1, __ATOMIC_RELAXED)) < closeness->candidate_count) {
+    closeness_try(worker, closeness->candidates[index].city);
+  }
+  char args[64];
+  snprintf(args, sizeof(args), "\"tried\":%zu,\"pruned\":%zu", worker->tried, worker->pruned);
+  tracer_span("closeness worker", getpid(), worker->index + 1, started, now_ns(), args);
+  return NULL;
+}
+
+/** Compares entries in the order in which they rank. */
+int closeness_entry_compare(const void *a, const void *b) {
+  closeness_entry_t x = *(const closeness_entry_t *) a, y = *(const closeness_entry_t *) b;
+  return closeness_before(x, y) ? -1 : closeness_before(y, x);
+}
+
+/**
+ * Finds the k cities with the highest closeness centrality, with one pruned breadth-first search per city.
+ * @param threads the number of worker threads, each with its own workspace.
+ * @param out where the cities are printed, from the most central one, with their closeness.
+ * @return 0, or 1 if an error occurred.
+ */
+int run_top_closeness(graph_t *graph, workspace_t *workspace, size_t k, size_t threads, FILE *out) {
+  if (graph_index_components(graph, workspace)) return 1;
+  closeness_t closeness;
+  memset(&closeness, 0, sizeof(closeness_t));
+  closeness.graph = graph;
+  closeness.k = k < graph->size - 1 ? k : graph->size - 1;
+  closeness.candidate_count = graph->size - 1;
+  closeness.candidates = (closeness_entry_t *) memory_alloc(MEMORY_QUEUES, closeness.candidate_count *
+                                                                             sizeof(closeness_entry_t), false);
+  closeness.best = (closeness_entry_t *) malloc((closeness.k + 1) * sizeof(closeness_entry_t));
+  if (!closeness.candidates || !closeness.best) {
+    memory_free(closeness.candidates);
+    free(closeness.best);
+    return 1;
+  }
+  for (size_t city = 1; city < graph->size; city++) {
+    closeness.candidates[city - 1] = (closeness_entry_t) {city, (double) graph_degree(graph, city)};
+  }
+  qsort(closeness.candidates, closeness.candidate_count, sizeof(closeness_entry_t), closeness_entry_compare);
+  pthread_mutex_init(&closeness.lock, NULL);
+
+  if (threads > closeness.candidate_count) threads = closeness.candidate_count ? closeness.candidate_count : 1;
+  closeness_worker_t workers[MAX_THREADS];
+  pthread_t handles[MAX_THREADS];
+  int error = 0;
+  for (size_t i = 0; i < threads; i++) {
+    memset(&workers[i], 0, sizeof(closeness_worker_t));
+    workers[i].closeness = &closeness;
+    workers[i].index = i;
+    workers[i].order = (city_t *) memory_alloc(MEMORY_QUEUES, graph->size * sizeof(city_t), false);
+    if (!workers[i].order || workspace_reserve(&workers[i].workspace, graph->size)) error = 1;
+    else memset(workers[i].workspace.visited, 0, graph->size * sizeof(bool));
+    char name[32];
+    snprintf(name, sizeof(name), "closeness worker %zu", i);
+    tracer_name("thread_name", getpid(), i + 1, name);
+  }
+  if (!error) {
+    size_t spawned = 0;
+    for (; spawned < threads; spawned++) {
+      if (pthread_create(&handles[spawned], NULL, closeness_worker_run, &workers[spawned])) break;
+    }
+    if (spawned == 0) closeness_worker_run(&workers[0]);
+    for (size_t i = 0; i < spawned; i++) pthread_join(handles[i], NULL);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    memory_free(workers[i].order);
+    workspace_free(&workers[i].workspace);
+  }
+  if (!error) {
+    for (size_t i = 0; i < closeness.best_count; i++) {
+      fprintf(out, "%zu %.6f\n", (size_t) closeness.best[i].city, closeness.best[i].closeness);
+    }
+  }
+  pthread_mutex_destroy(&closeness.lock);
+  memory_free(closeness.candidates);
+  free(closeness.best);
+  return error;
+}
+
+#define DISTANCE_INFINITE UINT64_MAX
+
+struct delta_search;
+
+/**
+ * A worker of a delta-stepping search, which owns the cities whose identifier modulo the number of workers is its
+ * index, and keeps them in its own buckets.
+ */
+typedef struct delta_worker {
+  struct delta_search *search;
+  size_t index;
+
+  /** The cities of this worker in each bucket, by bucket number modulo the number of buckets. */
+  city_list_t *buckets;
+
+  /** The cities whose distance this worker lowered, by owner, which the owners move to their buckets. */
+  city_list_t *outboxes;
+
+  /** Whether this worker has cities in the current bucket, once its outboxes were drained. */
+  bool pending;
+
+  /** The cities of the current bucket which are being expanded. */
+  city_list_t frontier;
+
+  /** The cities which were expanded in the current bucket, whose heavy roads are relaxed once it is empty. */
+  city_list_t settled;
+
+  /** The number of roads which were relaxed by the current query. */
+  uint64_t relaxed;
+  int error;
+} delta_worker_t;
+
+/**
+ * The state of the delta-stepping engine, which finds shortest paths in a weighted graph (Meyer and Sanders). The
+ * cities are put in buckets of width delta by their tentative distance. The cities of the first bucket which isn't
+ * empty are expanded in parallel through their light roads, which may put cities back in the same bucket, until it
+ * is empty; their heavy roads are then relaxed at once, since they only lead to later buckets.
+ */
+typedef struct delta_search {
+  const graph_t *graph;
+
+  /** The width of the buckets. */
+  uint64_t delta;
+
+  /** The number of buckets, which holds every tentative distance ahead of the current bucket. */
+  size_t bucket_count;
+
+  /** The tentative distance of each city, which workers lower atomically. */
+  uint64_t *distances;
+
+  size_t threads;
+  delta_worker_t *workers;
+  pthread_barrier_t barrier;
+
+  /** Held while the workers are started, and whether some of them could not be, so the others give up. */
+  pthread_mutex_t start;
+  bool aborted;
+
+  /** The city to which the distance is asked, or the size of the graph if all the distances are. */
+  size_t until;
+} delta_search_t;
+
+/** Returns the length of an entry of the adjacency lists, which is 1 if the graph has no weights. */
+static inline uint32_t graph_weight(const graph_t *graph, offset_t entry) {
+  return graph->weights ? graph->weights[entry] : 1;
+}
+
+/**
+ * Prepares a delta-stepping search over a graph with adjacency lists in memory.
+ * @param delta the width of the buckets, or 0 to use the average length of the roads.
+ * @return 0, or 1 if an error occurred.
+ */
+int delta_search_init(delta_search_t *search, const graph_t *graph, size_t threads, uint64_t delta) {
+  memset(search, 0, sizeof(delta_search_t));
+  search->graph = graph;
+  offset_t entries = graph->start[graph->size];
+  uint64_t total = 0, longest = 1;
+  for (offset_t entry = 0; entry < entries; entry++) {
+    uint32_t weight = graph_weight(graph, entry);
+    total += weight;
+    if (weight > longest) longest = weight;
+  }
+  search->delta = delta ? delta : entries && total / entries ? total / entries : 1;
+  search->bucket_count = longest / search->delta + 2;
+  search->threads = threads;
+  search->distances = (uint64_t *) memory_alloc(MEMORY_VISITED, graph->size * sizeof(uint64_t), false);
+  search->workers = (delta_worker_t *) calloc(threads, sizeof(delta_worker_t));
+  if (!search->distances || !search->workers) return 1;
+  for (size_t i = 0; i < threads; i++) {
+    search->workers[i].search = search;
+    search->workers[i].index = i;
+    search->workers[i].buckets = (city_list_t *) calloc(search->bucket_count, sizeof(city_list_t));
+    search->workers[i].outboxes = (city_list_t *) calloc(threads, sizeof(city_list_t));
+    if (!search->workers[i].buckets || !search->workers[i].outboxes) return 1;
+    char name[48];
+    snprintf(name, sizeof(name), "delta worker %zu", i);
+    tracer_name("thread_name", getpid(), i + 1, name);
+  }
+  pthread_barrier_init(&search->barrier, NULL, threads);
+  pthread_mutex_init(&search->start, NULL);
+  return 0;
+}
+
+/** Releases the resources of a delta-stepping search. */
+void delta_search_free(delta_search_t *search) {
+  if (!search->graph) return;
+  for (size_t i = 0; search->workers && i < search->threads; i++) {
+    delta_worker_t *worker = &search->workers[i];
+    for (size_t j = 0; worker->buckets && j < search->bucket_count; j++) memory_free(worker->buckets[j].items);
+    for (size_t j = 0; worker->outboxes && j < search->threads; j++) memory_free(worker->outboxes[j].items);
+    free(worker->buckets);
+    free(worker->outboxes);
+    memory_free(worker->frontier.items);
+    memory_free(worker->settled.items);
+  }
+  if (search->workers) {
+    pthread_barrier_destroy(&search->barrier);
+    pthread_mutex_destroy(&search->start);
+  }
+  free(search->workers);
+  memory_free(search->distances);
+  memset(search, 0, sizeof(delta_search_t));
+}
+
+/** Lowers the tentative distance of a city, and sends it to its owner if it was lowered. */
+static inline void delta_relax(delta_worker_t *worker, city_t city, uint64_t distance) {
+  delta_search_t *search = worker->search;
+  uint64_t current = __atomic_load_n(&search->distances[city], __ATOMIC_RELAXED);
+  while (distance < current) {
+    if (__atomic_compare_exchange_n(&search->distances[city], &current, distance, true, __ATOMIC_RELAXED,
+                                    __ATOMIC_RELAXED)) {
+      worker->error |= city_list_push(&worker->outboxes[city % search->threads], city);
+      return;
+    }
+  }
+}
+
+/**
+ * Moves the cities which the workers sent to a worker to the buckets of their distance, once every worker relaxed its
+ * roads, and tells whether the worker now has cities in a bucket.
+ */
+static void delta_drain(delta_worker_t *worker, size_t bucket) {
+  delta_search_t *search = worker->search;
+  for (size_t i = 0; i < search->threads; i++) {
+    city_list_t *inbox = &search->workers[i].outboxes[worker->index];
+    for (size_t j = 0; j < inbox->size; j++) {
+      city_t city = inbox->items[j];
+      size_t target = (search->distances[city] / search->delta) % search->bucket_count;
+      worker->error |= city_list_push(&worker->buckets[target], city);
+    }
+    inbox->size = 0;
+  }
+  worker->pending = worker->buckets[bucket].size > 0;
+}
+
+/** Relaxes the light or the heavy roads of a city. */
+static inline void delta_expand(delta_worker_t *worker, city_t city, bool light) {
+  delta_search_t *search = worker->search;
+  const graph_t *graph = search->graph;
+  uint64_t distance = __atomic_load_n(&search->distances[city], __ATOMIC_RELAXED);
+  for (offset_t entry = graph->start[city]; entry < graph->start[city + 1]; entry++) {
+    uint32_t weight = graph_weight(graph, entry);
+    if ((weight <= search->delta) != light) continue;
+    delta_relax(worker, city_load(&graph->neighbours[entry]), distance + weight);
+    worker->relaxed++;
+  }
+}
+
+/** Returns whether a worker of a search has cities in a bucket. */
+static bool delta_bucket_used(const delta_search_t *search, size_t bucket) {
+  for (size_t i = 0; i < search->threads; i++) {
+    if (search->workers[i].buckets[bucket].size > 0) return true;
+  }
+  return false;
+}
+
+/** Returns whether a worker of a search has cities in the current bucket. */
+static bool delta_pending(const delta_search_t *search) {
+  for (size_t i = 0; i < search->threads; i++) {
+    if (search->workers[i].pending) return true;
+  }
+  return false;
+}
+
+/**
+ * Runs the part of a search of a worker, which expands the cities it owns. All the workers go through the same
+ * buckets, and wait for each other after each round of light roads and after the heavy roads of each bucket, before
+ * they move the cities which were sent to them to their buckets.
+ */
+static void *delta_worker_run(void *argument) {
+  delta_worker_t *worker = (delta_worker_t *) argument;
+  delta_search_t *search = worker->search;
+  // The barriers wait for every worker, so the workers give up if some of them could not be started.
+  pthread_mutex_lock(&search->start);
+  bool aborted = search->aborted;
+  pthread_mutex_unlock(&search->start);
+  if (aborted) return NULL;
+  uint64_t started = now_ns();
+  uint64_t current = 0;
+  bool done = false;
+  while (!done) {
+    size_t bucket = current % search->bucket_count;
+    bool used = true;
+    while (used) {
+      // The bucket is emptied into the frontier, so the cities which come back to it are expanded in the next round.
+      city_list_t swap = worker->frontier;
+      worker->frontier = worker->buckets[bucket];
+      worker->buckets[bucket] = swap;
+      worker->buckets[bucket].size = 0;
+      for (size_t i = 0; i < worker->frontier.size; i++) {
+        city_t city = worker->frontier.items[i];
+        // Cities whose distance was lowered since they were put in the bucket were put in another one.
+        if (__atomic_load_n(&search->distances[city], __ATOMIC_RELAXED) / search->delta != current) continue;
+        worker->error |= city_list_push(&worker->settled, city);
+        delta_expand(worker, city, true);
+      }
+      pthread_barrier_wait(&search->barrier);
+      delta_drain(worker, bucket);
+      pthread_barrier_wait(&search->barrier);
+      // The flags are only written again after the next round of light roads, once every worker read them.
+      used = delta_pending(search);
+    }
+    for (size_t i = 0; i < worker->settled.size; i++) delta_expand(worker, worker->settled.items[i], false);
+    worker->settled.size = 0;
+    pthread_barrier_wait(&search->barrier);
+    delta_drain(worker, bucket);
+    pthread_barrier_wait(&search->barrier);
+
+    // Every worker picks the same next bucket, since they all read the same buckets between the same barriers.
+    done = true;
+    for (size_t step = 1; step < search->bucket_count && done; step++) {
+      if (delta_bucket_used(search, (current + step) % search->bucket_count)) {
+        current += step;
+        done = false;
+      }
+    }
+    // The cities which are left are at least as far as the current bucket, so the target can't get any closer.
+    if (!done && search->until < search->graph->size && search->distances[search->until] <= current * search->delta) {
+      done = true;
+    }
+    pthread_barrier_wait(&search->barrier);
+  }
+  char args[64];
+  snprintf(args, sizeof(args), "\"relaxed\":%llu", (unsigned long long) worker->relaxed);
+  tracer_span("delta worker", getpid(), worker->index + 1, started, now_ns(), args);
+  return NULL;
+}
+
+/**
+ * Computes the length of a shortest path between two cities of a weighted graph, with all the workers of a search.
+ * @param result where the length is stored, or IMPOSSIBLE if there is no path.
+ * @return 0, or 1 if an error occurred or if the length doesn't fit in the result.
+ */
+int delta_solve(delta_search_t *search, city_t from, city_t until, int *result) {
+  const graph_t *graph = search->graph;
+  for (size_t city = 0; city < graph->size; city++) search->distances[city] = DISTANCE_INFINITE;
+  int error = 0;
+  for (size_t i = 0; i < search->threads; i++) {
+    delta_worker_t *worker = &search->workers[i];
+    for (size_t j = 0; j < search->bucket_count; j++) worker->buckets[j].size = 0;
+    for (size_t j = 0; j < search->threads; j++) worker->outboxes[j].size = 0;
+    worker->relaxed = 0;
+    worker->error = 0;
+  }
+  search->until = until;
+  search->distances[from] = 0;
+  if (city_list_push(&search->workers[from % search->threads].buckets[0], from)) return 1;
+
+  pthread_t handles[MAX_THREADS];
+  size_t spawned = 0;
+  pthread_mutex_lock(&search->start);
+  for (; spawned + 1 < search->threads; spawned++) {
+    if (pthread_create(&handles[spawned], NULL, delta_worker_run, &search->workers[spawned + 1])) break;
+  }
+  search->aborted = spawned + 1 < search->threads;
+  pthread_mutex_unlock(&search->start);
+  if (!search->aborted) delta_worker_run(&search->workers[0]);
+  for (size_t i = 0; i < spawned; i++) pthread_join(handles[i], NULL);
+  if (search->aborted) return 1;
+  for (size_t i = 0; i < search->threads; i++) error |= search->workers[i].error;
+  uint64_t distance = search->distances[until];
+  if (error || (distance != DISTANCE_INFINITE && distance > INT32_MAX)) return 1;
+  *result = distance == DISTANCE_INFINITE ? IMPOSSIBLE : (int) distance;
+  return 0;
+}
+
+/**
+ * Answers the distance queries of a graph with one of the engines.
+ */
+typedef struct solver {
+
+  /** The engine which answers the queries. */
+  engine_t engine;
+
+  /** The graph, for the engines which run in this process. */
+  graph_t *graph;
+
+  /** The workspace of the breadth-first search. */
+  workspace_t workspace;
+
+  /** The shard processes of the sharded engine. */
+  shard_pool_t pool;
+
+  /** The latencies of the queries which were answered. */
+  metrics_t *metrics;
+
+  /** The log of the slowest queries. */
+  slow_log_t *slow_log;
+
+  /** The time spent preparing the graph, which is accounted to the next query. */
+  phases_t setup;
+
+  /** The log in which the queries are recorded, or NULL. */
+  workload_t *recorder;
+
+  /** The time budget of each query, in nanoseconds, or 0 if it is not limited. Ignored by the sharded engine. */
+  uint64_t budget_time;
+
+  /** The number of adjacency list entries which each query may scan, or 0 if it is not limited. */
+  uint64_t budget_edges;
+
+  /** The input which the edge-centric engine sweeps, and from which the graph is built if it gives up. */
+  input_t *input;
+
+  /** The number of levels after which the edge-centric engine gives up. */
+  size_t max_sweeps;
+
+  /** The workers and buckets of the delta-stepping engine. */
+  delta_search_t delta;
+
+  /** The distance labels of the labelling engine. */
+  labels_t labels;
+} solver_t;
+
+/** Runs the breadth-first search of a solver, within the budget of a query which started at the provided time. */
+static int solver_search(solver_t *solver, city_t from, city_t until, uint64_t started) {
+  budget_t budget = {solver->budget_time ? started + solver->budget_time : 0, solver->budget_edges};
+  return solve_within(solver->graph, &solver->workspace, from, until,
+                      solver->budget_time || solver->budget_edges ? &budget : NULL);
+}
+
+/**
+ * Computes the distance between two cities, and records the latency of the query. If the query runs out of budget,
+ * BOUNDED is stored and the bounds on the distance are stored in the workspace of the solver.
+ * @param result where the distance is stored, or IMPOSSIBLE if there is no path.
+ * @return 0, or 1 if an error occurred.
+ */
+int solver_answer(solver_t *solver, city_t from, city_t until, int *result) {
+  uint64_t started = now_ns();
+  const bfs_trace_t *trace;
+  if (solver->engine == ENGINE_SHARDED) {
+    *result = shard_pool_solve(&solver->pool, from, until);
+    trace = &solver->pool.trace;
+  } else if (solver->engine == ENGINE_EDGES) {
+    *result = solve_edges(solver->input, &solver->workspace, from, until, solver->max_sweeps);
+    if (*result == SWEEPS_EXCEEDED) {
+      // The graph is deeper than its estimate, so its adjacency lists are built after all.
+      if (graph_build(solver->graph, solver->input)) return 1;
+      input_free(solver->input);
+      solver->engine = ENGINE_BFS;
+      *result = solver_search(solver, from, until, started);
+    }
+    trace = &solver->workspace.trace;
+  } else if (solver->engine == ENGINE_BFS) {
+    *result = solver_search(solver, from, until, started);
+    trace = &solver->workspace.trace;
+  } else if (solver->engine == ENGINE_DELTA) {
+    if (delta_solve(&solver->delta, from, until, result)) return 1;
+    // The workers of the delta-stepping engine trace their own spans, rather than the levels of a search.
+    trace = &untraced;
+  } else {
+    *result = labels_query(&solver->labels, from, until);
+    trace = &untraced;
+  }
+  phases_t phases = solver->setup;
+  phases.solve = now_ns() - started;
+  memset(&solver->setup, 0, sizeof(phases_t));
+  if (solver->metrics) {
+    metrics_record(solver->metrics, solver->engine, outcome_of(*result), phases.solve);
+  }
+  if (solver->slow_log) slow_log_record(solver->slow_log, NULL, solver->engine, from, until, *result, &phases, trace);
+  tracer_span("query", getpid(), 0, started, started + phases.solve, NULL);
+  return 0;
+}
+
+/** Records a query in the workload log of a solver, and answers it like solver_answer. */
+int solver_query(solver_t *solver, city_t from, city_t until, int *result) {
+  workload_query(solver->recorder, 0, from, until);
+  return solver_answer(solver, from, until, result);
+}
+
+/** Releases the resources of a solver. */
+void solver_free(solver_t *solver) {
+  if (solver->engine == ENGINE_SHARDED) shard_pool_stop(&solver->pool);
+  delta_search_free(&solver->delta);
+  labels_free(&solver->labels);
+  workspace_free(&solver->workspace);
+}
+
+/** Prints the answer to a distance query, or its bounds if it ran out of budget. */
+void print_result(FILE *out, int result, const bounds_t *bounds) {
+  char answer[32];
+  format_result(answer, sizeof(answer), result, bounds);
+  fprintf(out, "%s\n", answer);
+}
+
+#define RESULT_WRITER_CAPACITY (1 << 16)
+
+/**
+ * Writes the answers of many queries to a file descriptor, formatting them in a large buffer which is written with
+ * few system calls, rather than through the locks and format parsing of stdio.
+ */
+typedef struct result_writer {
+  int fd;
+  size_t size;
+
+  /** Whether a write failed, in which case the following answers are discarded. */
+  bool failed;
+  char buffer[RESULT_WRITER_CAPACITY];
+} result_writer_t;
+
+static const char digit_pairs[201] = "00010203040506070809101112131415161718192021222324"
+                                     "25262728293031323334353637383940414243444546474849"
+                                     "50515253545556575859606162636465666768697071727374"
+                                     "75767778798081828384858687888990919293949596979899";
+
+/** Prepares a writer which appends to a stream, after the text which is buffered by the stream. */
+void result_writer_open(result_writer_t *writer, FILE *out) {
+  fflush(out);
+  writer->fd = fileno(out);
+  writer->size = 0;
+  writer->failed = false;
+}
+
+/**
+ * Writes the buffered answers.
+ * @return 0, or 1 if an error occurred.
+ */
+int result_writer_flush(result_writer_t *writer) {
+  for (size_t written = 0; written < writer->size && !writer->failed;) {
+    ssize_t count = write(writer->fd, writer->buffer + written, writer->size - written);
+    if (count < 0 && errno == EINTR) continue;
+    if (count <= 0) writer->failed = true;
+    else written += count;
+  }
+  writer->size = 0;
+  return writer->failed;
+}
+
+/** Appends the answer to a distance query, on its own line. */
+static inline void result_writer_put(result_writer_t *writer, int result, const bounds_t *bounds) {
+  if (writer->size + 32 > RESULT_WRITER_CAPACITY) result_writer_flush(writer);
+  char *cursor = writer->buffer + writer->size;
+  if (result < 0) {
+    char answer[32];
+    format_result(answer, sizeof(answer), result, bounds);
+    size_t length = strlen(answer);
+    memcpy(cursor, answer, length);
+    cursor[length] = '\n';
+    writer->size += length + 1;
+    return;
+  }
+  // The digits are written backwards, two at a time, then moved in place.
+  char digits[16];
+  char *end = digits + sizeof(digits), *start = end;
+  unsigned value = (unsigned) result;
+  while (value >= 100) {
+    unsigned pair = (value % 100) * 2;
+    value /= 100;
+    *--start = digit_pairs[pair + 1];
+    *--start = digit_pairs[pair];
+  }
+  if (value >= 10) {
+    *--start = digit_pairs[value * 2 + 1];
+    *--start = digit_pairs[value * 2];
+  } else {
+    *--start = (char) ('0' + value);
+  }
+  size_t length = end - start;
+  memcpy(cursor, start, length);
+  cursor[length] = '\n';
+  writer->size += length + 1;
+}
+
+// The number of queries which share an endpoint above which they're answered by a single full search.
+#define BATCH_GROUP_MIN 2
+
+/**
+ * A query of a batch, oriented so that its source is the more frequent of its endpoints.
+ */
+typedef struct batch_query {
+  city_t source;
+  city_t target;
+
+  /** The position of the query in the batch, where its answer is printed. */
+  size_t index;
+
+  /** Whether the source and the target were swapped from the query as it was read. */
+  bool folded;
+} batch_query_t;
+
+/** Orders the queries of a batch by source, then by position. */
+int batch_query_compare(const void *a, const void *b) {
+  const batch_query_t *left = (const batch_query_t *) a, *right = (const batch_query_t *) b;
+  if (left->source != right->source) return left->source < right->source ? -1 : 1;
+  return left->index < right->index ? -1 : left->index > right->index;
+}
+
+/**
+ * Answers a batch of queries by grouping them by endpoint. Since the roads go both ways, each query is folded onto
+ * its more frequent endpoint, and the queries which share that endpoint are answered by a single full search from it.
+ * The latency of a group is shared evenly between its queries, which are each logged and traced with their share.
+ * @param queries the queries, in the order in which they were read.
+ * @return 0, or 1 if an error occurred.
+ */
+int solver_query_grouped(solver_t *solver, batch_query_t *queries, size_t count, int *results) {
+  const graph_t *graph = solver->graph;
+  uint32_t *frequencies = (uint32_t *) memory_alloc(MEMORY_BATCHES, graph->size * sizeof(uint32_t), true);
+  int *distances = (int *) memory_alloc(MEMORY_BATCHES, graph->size * sizeof(int), false);
+  if (!frequencies || !distances) {
+    memory_free(frequencies);
+    memory_free(distances);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) {
+    // The queries are recorded as they were read, so replaying them runs the same workload.
+    workload_query(solver->recorder, 0, queries[i].source, queries[i].target);
+    frequencies[queries[i].source]++;
+    frequencies[queries[i].target]++;
+  }
+  for (size_t i = 0; i < count; i++) {
+    city_t source = queries[i].source, target = queries[i].target;
+    if (frequencies[target] > frequencies[source] || (frequencies[target] == frequencies[source] && target < source)) {
+      queries[i].source = target;
+      queries[i].target = source;
+      queries[i].folded = true;
+    }
+  }
+  memory_free(frequencies);
+  qsort(queries, count, sizeof(batch_query_t), batch_query_compare);
+
+  int error = 0;
+  for (size_t first = 0, last; first < count && !error; first = last) {
+    for (last = first + 1; last < count && queries[last].source == queries[first].source; last++);
+    if (last - first < BATCH_GROUP_MIN) {
+      // A lone query is cheaper to answer with a search which stops at its target.
+      for (size_t i = first; i < last && !error; i++) {
+        city_t from = queries[i].folded ? queries[i].target : queries[i].source;
+        city_t until = queries[i].folded ? queries[i].source : queries[i].target;
+        error = solver_answer(solver, from, until, &results[queries[i].index]);
+      }
+      continue;
+    }
+    uint64_t started = now_ns();
+    error = bfs_distances(graph, &solver->workspace, queries[first].source, distances);
+    uint64_t share = (now_ns() - started) / (last - first);
+    for (size_t i = first; i < last && !error; i++) {
+      int result = distances[queries[i].target];
+      results[queries[i].index] = result;
+      phases_t phases = solver->setup;
+      phases.solve = share;
+      memset(&solver->setup, 0, sizeof(phases_t));
+      if (solver->metrics) metrics_record(solver->metrics, solver->engine, outcome_of(result), share);
+      if (solver->slow_log) {
+        // The search of the group goes on past the target, so each query only keeps the levels up to its target.
+        bfs_trace_t trace = solver->workspace.trace;
+        if (result != IMPOSSIBLE && (size_t) result < trace.levels) trace.levels = result + 1;
+        if (trace.hub_level > result && result != IMPOSSIBLE) trace.hub_level = -1;
+        city_t from = queries[i].folded ? queries[i].target : queries[i].source;
+        city_t until = queries[i].folded ? queries[i].source : queries[i].target;
+        slow_log_record(solver->slow_log, NULL, solver->engine, from, until, result, &phases, &trace);
+      }
+      uint64_t offset = started + (i - first) * share;
+      tracer_span("query", getpid(), 0, offset, offset + share, NULL);
+    }
+    if (tracer.file) {
+      char args[64];
+      snprintf(args, sizeof(args), "\"source\":%llu,\"queries\":%zu", (unsigned long long) queries[first].source,
+               last - first);
+      tracer_span("group", getpid(), 0, started, now_ns(), args);
+    }
+  }
+  memory_free(distances);
+  return error;
+}
+
+/**
+ * Answers the distance queries of a batch file, which contains one pair of cities per line. The answers are printed
+ * in the order of the queries. Unless the queries have a budget, the BFS engine reads the whole batch and groups its
+ * queries by endpoint; the other engines answer the queries one by one, as they're read.
+ * @return 0, or 1 if an error occurred.
+ */
+int run_batch(solver_t *solver, size_t size, const char *path, FILE *out) {
+  FILE *file = fopen(path, "r");
+  if (!file) return 1;
+  unsigned long long from, until;
+  int error = 0;
+  result_writer_t writer;
+  result_writer_open(&writer, out);
+  if (solver->engine != ENGINE_BFS || solver->budget_time || solver->budget_edges) {
+    while (fscanf(file, "%llu %llu", &from, &until) == 2) {
+      if (from >= size || until >= size) {
+        error = 1;
+        break;
+      }
+      int result;
+      if (solver_query(solver, from, until, &result)) {
+        error = 1;
+        break;
+      }
+      result_writer_put(&writer, result, &solver->workspace.bounds);
+    }
+    fclose(file);
+    return result_writer_flush(&writer) || error;
+  }
+
+  size_t count = 0, capacity = 0;
+  batch_query_t *queries = NULL;
+  while (fscanf(file, "%llu %llu", &from, &until) == 2) {
+    if (from >= size || until >= size) {
+      error = 1; // The queries before the invalid one are still answered.
+      break;
+    }
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : DEFAULT_CAPACITY;
+      batch_query_t *grown = (batch_query_t *) memory_realloc(MEMORY_BATCHES, queries,
+                                                              capacity * sizeof(batch_query_t));
+      if (!grown) {
+        memory_free(queries);
+        fclose(file);
+        return 1;
+      }
+      queries = grown;
+    }
+    queries[count] = (batch_query_t) {from, until, count, false};
+    count++;
+  }
+  fclose(file);
+  int *results = (int *) memory_alloc(MEMORY_BATCHES, count * sizeof(int) + 1, false);
+  if (!results || solver_query_grouped(solver, queries, count, results)) {
+    memory_free(queries);
+    memory_free(results);
+    return 1;
+  }
+  for (size_t i = 0; i < count; i++) result_writer_put(&writer, results[i], NULL);
+  memory_free(queries);
+  memory_free(results);
+  return result_writer_flush(&writer) || error;
+}
+
+/**
+ * Prints the distance between a city and every city of a graph, one per line, in the order of the cities.
+ * @return 0, or 1 if an error occurred.
+ */
+int run_all_distances(const graph_t *graph, workspace_t *workspace, city_t from, FILE *out) {
+  int *distances = (int *) memory_alloc(MEMORY_BATCHES, graph->size * sizeof(int) + 1, false);
+  result_writer_t *writer = (result_writer_t *) malloc(sizeof(result_writer_t));
+  int error = !distances || !writer || bfs_distances(graph, workspace, from, distances);
+  if (!error) {
+    result_writer_open(writer, out);
+    for (size_t city = 0; city < graph->size; city++) result_writer_put(writer, distances[city], NULL);
+    error = result_writer_flush(writer);
+  }
+  memory_free(distances);
+  free(writer);
+  return error;
+}
+
+#define MATRIX_SOURCES 64
+
+/**
+ * The state shared by the workers which compute a distance matrix. Each worker runs the breadth-first searches of
+ * 64 sources at once, with one bit per source in the sets of each city (Then et al., MS-BFS), so the adjacency lists
+ * are scanned once per level for all of them.
+ */
+typedef struct matrix {
+  const graph_t *graph;
+
+  /** The distinct cities of the matrix, and the index of each city among them, or -1. */
+  city_t *cities;
+  size_t count;
+  int *indexes;
+
+  /** The distances between the distinct cities, row by row. */
+  int *distances;
+
+  /** The index of the next group of sources, which workers take atomically. */
+  size_t next;
+} matrix_t;
+
+/** A worker which runs the searches of groups of sources. */
+typedef struct matrix_worker {
+  matrix_t *matrix;
+  size_t index;
+
+  /** For each city, the sources which have reached it, which reach it at the current level, and at the next one. */
+  uint64_t *seen;
+  uint64_t *visit;
+  uint64_t *reached;
+} matrix_worker_t;
+
+/** Runs the searches of the sources of a group, until all the cities of the matrix are reached. */
+static void matrix_group(matrix_worker_t *worker, size_t first, size_t last) {
+  const matrix_t *matrix = worker->matrix;
+  const graph_t *graph = matrix->graph;
+  uint64_t *seen = worker->seen, *visit = worker->visit, *reached = worker->reached;
+  memset(seen, 0, graph->size * sizeof(uint64_t));
+  memset(visit, 0, graph->size * sizeof(uint64_t));
+  memset(reached, 0, graph->size * sizeof(uint64_t));
+  for (size_t i = first; i < last; i++) {
+    for (size_t j = 0; j < matrix->count; j++) matrix->distances[i * matrix->count + j] = IMPOSSIBLE;
+    matrix->distances[i * matrix->count + i] = 0;
+    seen[matrix->cities[i]] |= UINT64_C(1) << (i - first);
+    visit[matrix->cities[i]] |= UINT64_C(1) << (i - first);
+  }
+  size_t remaining = (last - first) * (matrix->count - 1);
+  bool active = true;
+  for (int level = 1; active && remaining > 0; level++) {
+    for (size_t city = 0; city < graph->size; city++) {
+      if (!visit[city]) continue;
+      neighbour_iterator_t it;
+      city_t neighbour;
+      graph_neighbours(graph, city, &it);
+      while (neighbour_iterator_next(graph, &it, &neighbour)) reached[neighbour] |= visit[city];
+    }
+    active = false;
+    for (size_t city = 0; city < graph->size; city++) {
+      uint64_t sources = reached[city] & ~seen[city];
+      reached[city] = 0;
+      visit[city] = sources;
+      if (!sources) continue;
+      active = true;
+      seen[city] |= sources;
+      int column = matrix->indexes[city];
+      if (column < 0) continue;
+      for (; sources; sources &= sources - 1) {
+        size_t row = first + __builtin_ctzll(sources);
+        matrix->distances[row * matrix->count + column] = level;
+        remaining--;
+      }
+    }
+  }
+}
+
+/** Runs groups of sources until there are none left. */
+static void *matrix_worker_run(void *argument) {
+  matrix_worker_t *worker = (matrix_worker_t *) argument;
+  matrix_t *matrix = worker->matrix;
+  uint64_t started = now_ns();
+  size_t groups = (matrix->count + MATRIX_SOURCES - 1) / MATRIX_SOURCES, group, ran = 0;
+  while ((group = __atomic_fetch_add(&matrix->next, 1, __ATOMIC_RELAXED)) < groups) {
+    size_t first = group * MATRIX_SOURCES, last = first + MATRIX_SOURCES;
+    matrix_group(worker, first, last < matrix->count ? last : matrix->count);
+    ran++;
+  }
+  char args[64];
+  snprintf(args, sizeof(args), "\"groups\":%zu", ran);
+  tracer_span("matrix worker", getpid(), worker->index + 1, started, now_ns(), args);
+  return NULL;
+}
+
+/**
+ * Writes the distances between each pair of the cities listed in a file, as a dense matrix of signed integers in the
+ * byte order of the machine, row by row, with -1 for the cities which can't be reached.
+ * @param width the number of bits of each distance, 16 or 32.
+ * @param threads the number of worker threads, each with its own sets.
+ * @return 0, or 1 if an error occurred, or if a distance doesn't fit in the width.
+ */
+int run_matrix(const graph_t *graph, const char *path, unsigned width, size_t threads, FILE *out) {
+  FILE *file = fopen(path, "r");
+  if (!file) return 1;
+  size_t count = 0, capacity = 0;
+  city_t *list = NULL;
+  unsigned long long city;
+  int error = 0;
+  while (!error && fscanf(file, "%llu", &city) == 1) {
+    if (city >= graph->size) error = 1;
+    if (!error && count == capacity) {
+      capacity = capacity ? capacity * 2 : DEFAULT_CAPACITY;
+      city_t *grown = (city_t *) memory_realloc(MEMORY_BATCHES, list, capacity * sizeof(city_t));
+      if (!grown) error = 1;
+      else list = grown;
+    }
+    if (!error) list[count++] = city;
+  }
+  fclose(file);
+
+  // The searches only run from the distinct cities, and the rows and columns of the others are copies.
+  matrix_t matrix;
+  memset(&matrix, 0, sizeof(matrix_t));
+  matrix.graph = graph;
+  matrix.indexes = (int *) memory_alloc(MEMORY_BATCHES, graph->size * sizeof(int), false);
+  matrix.cities = (city_t *) memory_alloc(MEMORY_BATCHES, count * sizeof(city_t) + 1, false);
+  error = error || !matrix.indexes || !matrix.cities;
+  if (!error) {
+    for (size_t i = 0; i < graph->size; i++) matrix.indexes[i] = -1;
+    for (size_t i = 0; i < count; i++) {
+      if (matrix.indexes[list[i]] >= 0) continue;
+      matrix.indexes[list[i]] = (int) matrix.count;
+      matrix.cities[matrix.count++] = list[i];
+    }
+    matrix.distances = (int *) memory_alloc(MEMORY_BATCHES, matrix.count * matrix.count * sizeof(int) + 1, false);
+    error = !matrix.distances;
+  }
+
+  if (threads > (matrix.count + MATRIX_SOURCES - 1) / MATRIX_SOURCES) {
+    threads = matrix.count ? (matrix.count + MATRIX_SOURCES - 1) / MATRIX_SOURCES : 1;
+  }
+  matrix_worker_t workers[MAX_THREADS];
+  pthread_t handles[MAX_THREADS];
+  memset(workers, 0, threads * sizeof(matrix_worker_t));
+  for (size_t i = 0; i < threads && !error; i++) {
+    workers[i] = (matrix_worker_t) {&matrix, i, NULL, NULL, NULL};
+    workers[i].seen = (uint64_t *) memory_alloc(MEMORY_VISITED, graph->size * sizeof(uint64_t), false);
+    workers[i].visit = (uint64_t *) memory_alloc(MEMORY_VISITED, graph->size * sizeof(uint64_t), false);
+    workers[i].reached = (uint64_t *) memory_alloc(MEMORY_VISITED, graph->size * sizeof(uint64_t), false);
+    error = !workers[i].seen || !workers[i].visit || !workers[i].reached;
+    char name[32];
+    snprintf(name, sizeof(name), "matrix worker %zu", i);
+    tracer_name("thread_name", getpid(), i + 1, name);
+  }
+  if (!error) {
+    size_t spawned = 0;
+    for (; spawned < threads; spawned++) {
+      if (pthread_create(&handles[spawned], NULL, matrix_worker_run, &workers[spawned])) break;
+    }
+    if (spawned == 0) matrix_worker_run(&workers[0]);
+    for (size_t i = 0; i < spawned; i++) pthread_join(handles[i], NULL);
+  }
+  for (size_t i = 0; i < threads; i++) {
+    memory_free(workers[i].seen);
+    memory_free(workers[i].visit);
+    memory_free(workers[i].reached);
+  }
+
+  int limit = width == 16 ? INT16_MAX : INT32_MAX;
+  for (size_t i = 0; !error && i < matrix.count * matrix.count; i++) {
+    if (matrix.distances[i] > limit) {
+      fprintf(stderr, "The distance %d doesn't fit in %u bits.\n", matrix.distances[i], width);
+      error = 1;
+    }
+  }
+  // Each row is written at once, after it is narrowed to the width of the distances.
+  int32_t *row = (int32_t *) malloc(count * sizeof(int32_t) + 1);
+  error = error || !row;
+  for (size_t i = 0; !error && i < count; i++) {
+    const int *distances = matrix.distances + (size_t) matrix.indexes[list[i]] * matrix.count;
+    if (width == 16) {
+      int16_t *narrow = (int16_t *) row;
+      for (size_t j = 0; j < count; j++) narrow[j] = (int16_t) distances[matrix.indexes[list[j]]];
+    } else {
+      for (size_t j = 0; j < count; j++) row[j] = distances[matrix.indexes[list[j]]];
+    }
+    error = fwrite(row, width / 8, count, out) != count;
+  }
+  free(row);
+  memory_free(list);
+  memory_free(matrix.indexes);
+  memory_free(matrix.cities);
+  memory_free(matrix.distances);
+  return error || fflush(out) != 0;
+}
+
+/** Prints a summary of the latencies of a histogram. */
+void print_latency_summary(FILE *out, const histogram_t *histogram) {
+  fprintf(out, "latency p50 %.3f us p90 %.3f us p99 %.3f us p999 %.3f us max %.3f us\n",
+          histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.9) / 1e3,
+          histogram_quantile(histogram, 0.99) / 1e3, histogram_quantile(histogram, 0.999) / 1e3,
+          histogram->max / 1e3);
+}
+
+/** Waits until the provided time of a monotonic clock, in nanoseconds. */
+void sleep_until(uint64_t deadline) {
+  uint64_t now = now_ns();
+  if (now >= deadline) return;
+  struct timespec duration = {(time_t) ((deadline - now) / 1000000000), (long) ((deadline - now) % 1000000000)};
+  nanosleep(&duration, NULL);
+}
+
+/**
+ * Re-executes the queries of a workload log, and prints the throughput and the latency distribution of the replay.
+ * The queries are either run against a server, which replays the registrations, evictions and road changes of the log,
+ * or against the graph of a solver, in which case the graphs of the log and their changes are ignored.
+ * @param server the server against which the log is replayed, or NULL.
+ * @param solver the solver against which the log is replayed, when there is no server.
+ * @param max_speed whether the records are replayed as fast as possible, rather than at their original pace.
+ * @return 0, or 1 if an error occurred.
+ */
+int run_replay(server_t *server, solver_t *solver, size_t size, const char *path, bool max_speed, FILE *out) {
+  workload_t workload;
+  if (workload_open(&workload, path)) {
+    if (workload.file) fclose(workload.file);
+    return 1;
+  }
+  histogram_t *latencies = (histogram_t *) calloc(1, sizeof(histogram_t));
+  char **names = NULL; // The name of each graph of the log, for the replay against a server.
+  size_t count = 0;
+  workload_entry_t entry;
+  int error = !latencies;
+  uint64_t started = now_ns();
+  while (!error && !workload_next(&workload, &entry)) {
+    if (!max_speed) sleep_until(started + entry.offset);
+    if (entry.kind == WORKLOAD_QUERY) {
+      uint64_t before = now_ns();
+      if (server && entry.graph < count && names[entry.graph]) {
+        server_query(server, names[entry.graph], entry.from, entry.until, NULL, NULL);
+      } else if (!server && entry.from < size && entry.until < size) {
+        int result;
+        error = solver_query(solver, entry.from, entry.until, &result);
+      }
+      histogram_record(latencies, now_ns() - before);
+    } else if (entry.kind == WORKLOAD_LOAD && server) {
+      if (entry.graph >= count) {
+        char **grown = (char **) realloc(names, (entry.graph + 1) * sizeof(char *));
+        if (!grown) {
+          error = 1;
+          break;
+        }
+        names = grown;
+        while (count <= entry.graph) names[count++] = NULL;
+      }
+      free(names[entry.graph]);
+      names[entry.graph] = strdup(entry.name);
+      error = !names[entry.graph] || server_register(server, entry.name, entry.path);
+    } else if (entry.kind == WORKLOAD_UNLOAD && server && entry.graph < count && names[entry.graph]) {
+      tenant_t *tenant = server_find(server, names[entry.graph]);
+      if (tenant) server_evict(server, tenant);
+    } else if (entry.kind == WORKLOAD_ROAD && server && entry.graph < count && names[entry.graph]) {
+      server_add_road(server, names[entry.graph], entry.from, entry.until, NULL);
+    }
+  }
+  uint64_t elapsed = now_ns() - started;
+  fclose(workload.file);
+  if (!error) {
+    fprintf(out, "replayed %llu queries in %.3f s (%.0f queries/s)\n", (unsigned long long) latencies->total,
+            elapsed / 1e9, elapsed ? latencies->total / (elapsed / 1e9) : 0.0);
+    print_latency_summary(out, latencies);
+  }
+  for (size_t i = 0; i < count; i++) free(names[i]);
+  free(names);
+  free(latencies);
+  return error;
+}
+
+/**
+ * The options with which the program was started.
+ */
+typedef struct options {
+
+  /** Whether the graph should be stored in the succinct layout. */
+  bool succinct;
+
+  /** Where a binary snapshot of the graph should be written, or NULL. */
+  const char *snapshot;
+
+  /** Whether the program should run as a server, rather than answer the query of its input. */
+  bool serve;
+
+  /** The number of bytes which may be used by the graphs of a server. 0 if there is no limit. */
+  size_t max_resident;
+
+  /** The number of shard processes over which the search is run. 0 if the search runs in this process. */
+  size_t shards;
+
+  /** Whether the cities are split in ranges of identifiers, rather than with label propagation. */
+  bool ranges;
+
+  /** The number of parts in which the graph is split by the partitioning tool. 0 if the tool is not used. */
+  size_t parts;
+
+  /** The prefix of the files of the parts. */
+  const char *parts_prefix;
+
+  /** The prefix of the files of the parts from which the shards load their graph, or NULL to split the input. */
+  const char *shard_parts;
+
+  /** The file of the queries of batch mode, or NULL if only the query of the input is answered. */
+  const char *batch;
+
+  /** The file to which the metrics are exported, or NULL. */
+  const char *metrics;
+
+  /** The file in which the slowest queries are logged, or NULL. */
+  const char *slow_log;
+
+  /** The time above which a query is logged, in nanoseconds. */
+  uint64_t slow_threshold;
+
+  /** The file in which the queries and graph changes are recorded, or NULL. */
+  const char *record;
+
+  /** The workload log which is replayed, or NULL. */
+  const char *replay;
+
+  /** Whether the workload log is replayed as fast as possible. */
+  bool max_speed;
+
+  /** The file to which the timeline of the process is written, or NULL. */
+  const char *trace;
+
+  /** The time budget of each query, in nanoseconds, or 0 if it is not limited. */
+  uint64_t budget_time;
+
+  /** The number of adjacency list entries which each query may scan, or 0 if it is not limited. */
+  uint64_t budget_edges;
+
+  /** Whether the server reorders its queries by expected cost. */
+  bool schedule;
+
+  /** Whether the server appends the changes of its graphs to delta logs next to their snapshots. */
+  bool delta_log;
+
+  /** Whether the distances from the source of the input to every city are printed, rather than a single distance. */
+  bool all_distances;
+
+  /** The number of bytes of memory which the graph and its indexes may use, or 0 if there is no limit. */
+  size_t max_memory;
+
+  /** Whether the graph is built from sorted runs on disk, even if it would fit in memory. */
+  bool external;
+
+  /** The directory in which the graphs and their indexes are cached, or NULL. */
+  const char *cache_dir;
+
+  /** Whether the memory used by each structure is reported on the error output when the process ends. */
+  bool memory_report;
+
+  /** The engine which answers a single query, or ENGINE_COUNT if it is chosen from the size of the graph. */
+  engine_t engine;
+
+  /** Whether the distance distribution of the graph is estimated, rather than a distance answered. */
+  bool anf;
+
+  /** The logarithm of the number of registers of each counter of the distance distribution estimate. */
+  unsigned anf_registers;
+
+  /** The number of worker threads of the analytics. */
+  size_t threads;
+
+  /** The number of cities with the highest closeness centrality which are printed, or 0. */
+  size_t top_closeness;
+
+  /** The file which lists the cities of the distance matrix which is written, or NULL. */
+  const char *matrix;
+
+  /** The number of bits of each distance of the matrix. */
+  unsigned matrix_width;
+
+  /** Whether each road of the input is followed by its length. */
+  bool road_lengths;
+
+  /** Whether the distances are the lengths of the shortest paths rather than their number of roads and flights. */
+  bool weighted;
+
+  /** The cost of a flight between two airports, when the distances are weighted. */
+  uint32_t flight_cost;
+
+  /** The width of the buckets of the delta-stepping engine, or 0 to use the average length of the roads. */
+  uint64_t delta;
+} options_t;
+
+/**
+ * Parses the command line options.
+ * @return 0, or 1 if an option is not valid.
+ */
+int parse_options(options_t *options, int argc, char **argv) {
+  memset(options, 0, sizeof(options_t));
+  options->slow_threshold = DEFAULT_SLOW_THRESHOLD_NS;
+  options->engine = ENGINE_COUNT;
+  options->anf_registers = ANF_DEFAULT_LOG_REGISTERS;
+  options->threads = default_threads();
+  options->matrix_width = 32;
+  options->flight_cost = 2;
+  for (int i = 1; i < argc; i++) {
+    bool has_value = i + 1 < argc;
+    if (strcmp(argv[i], "--succinct") == 0) {
+      options->succinct = true;
+    } else if (strcmp(argv[i], "--snapshot") == 0 && has_value) {
+      options->snapshot = argv[++i];
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      options->serve = true;
+    } else if (strcmp(argv[i], "--shards") == 0 && has_value) {
+      options->shards = strtoul(argv[++i], NULL, 10);
+      if (options->shards < 1 || options->shards > MAX_SHARDS) {
+        fprintf(stderr, "The number of shards must be between 1 and %d.\n", MAX_SHARDS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--parts") == 0 && has_value) {
+      options->shard_parts = argv[++i];
+    } else if (strcmp(argv[i], "--ranges") == 0) {
+      options->ranges = true;
+    } else if (strcmp(argv[i], "--partition") == 0 && i + 2 < argc) {
+      options->parts = strtoul(argv[++i], NULL, 10);
+      options->parts_prefix = argv[++i];
+      if (options->parts < 1 || options->parts > MAX_SHARDS) {
+        fprintf(stderr, "The number of parts must be between 1 and %d.\n", MAX_SHARDS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--batch") == 0 && has_value) {
+      options->batch = argv[++i];
+    } else if (strcmp(argv[i], "--metrics") == 0 && has_value) {
+      options->metrics = argv[++i];
+    } else if (strcmp(argv[i], "--slow-log") == 0 && has_value) {
+      options->slow_log = argv[++i];
+    } else if (strcmp(argv[i], "--slow-threshold-us") == 0 && has_value) {
+      options->slow_threshold = strtoull(argv[++i], NULL, 10) * 1000;
+    } else if (strcmp(argv[i], "--record") == 0 && has_value) {
+      options->record = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && has_value) {
+      options->replay = argv[++i];
+    } else if (strcmp(argv[i], "--max-speed") == 0) {
+      options->max_speed = true;
+    } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+      options->trace = argv[++i];
+    } else if (strcmp(argv[i], "--all-distances") == 0) {
+      options->all_distances = true;
+    } else if (strcmp(argv[i], "--schedule") == 0) {
+      options->schedule = true;
+    } else if (strcmp(argv[i], "--budget-us") == 0 && has_value) {
+      options->budget_time = strtoull(argv[++i], NULL, 10) * 1000;
+    } else if (strcmp(argv[i], "--budget-edges") == 0 && has_value) {
+      options->budget_edges = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--engine") == 0 && has_value) {
+      i++;
+      if (strcmp(argv[i], engine_names[ENGINE_BFS]) == 0) {
+        options->engine = ENGINE_BFS;
+      } else if (strcmp(argv[i], engine_names[ENGINE_EDGES]) == 0) {
+        options->engine = ENGINE_EDGES;
+      } else if (strcmp(argv[i], engine_names[ENGINE_DELTA]) == 0) {
+        options->engine = ENGINE_DELTA;
+      } else if (strcmp(argv[i], engine_names[ENGINE_LABELS]) == 0) {
+        options->engine = ENGINE_LABELS;
+      } else {
+        fprintf(stderr, "Unknown engine %s.\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--anf") == 0) {
+      options->anf = true;
+    } else if (strcmp(argv[i], "--anf-registers") == 0 && has_value) {
+      options->anf_registers = strtoul(argv[++i], NULL, 10);
+      if (options->anf_registers < 4 || options->anf_registers > ANF_MAX_LOG_REGISTERS) {
+        fprintf(stderr, "The logarithm of the number of registers must be between 4 and %d.\n", ANF_MAX_LOG_REGISTERS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--top-closeness") == 0 && has_value) {
+      options->top_closeness = strtoul(argv[++i], NULL, 10);
+      if (options->top_closeness < 1) {
+        fprintf(stderr, "The number of central cities must be positive.\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--matrix") == 0 && has_value) {
+      options->matrix = argv[++i];
+    } else if (strcmp(argv[i], "--matrix-width") == 0 && has_value) {
+      options->matrix_width = strtoul(argv[++i], NULL, 10);
+      if (options->matrix_width != 16 && options->matrix_width != 32) {
+        fprintf(stderr, "The distances of the matrix must have 16 or 32 bits.\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--weighted") == 0) {
+      options->road_lengths = true;
+      options->weighted = true;
+    } else if (strcmp(argv[i], "--flight-cost") == 0 && has_value) {
+      options->flight_cost = strtoul(argv[++i], NULL, 10);
+      options->weighted = true;
+    } else if (strcmp(argv[i], "--delta") == 0 && has_value) {
+      options->delta = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--threads") == 0 && has_value) {
+      options->threads = strtoul(argv[++i], NULL, 10);
+      if (options->threads < 1 || options->threads > MAX_THREADS) {
+        fprintf(stderr, "The number of threads must be between 1 and %d.\n", MAX_THREADS);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--memory-report") == 0) {
+      options->memory_report = true;
+    } else if (strcmp(argv[i], "--delta-log") == 0) {
+      options->delta_log = true;
+    } else if (strcmp(argv[i], "--cache-dir") == 0 && has_value) {
+      options->cache_dir = argv[++i];
+    } else if (strcmp(argv[i], "--external") == 0) {
+      options->external = true;
+    } else if (strcmp(argv[i], "--max-memory") == 0 && has_value) {
+      options->max_memory = parse_bytes(argv[++i]);
+      if (!options->max_memory) {
+        fprintf(stderr, "Invalid size %s.\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--max-resident") == 0 && has_value) {
+      options->max_resident = parse_bytes(argv[++i]);
+      if (!options->max_resident) {
+        fprintf(stderr, "Invalid size %s.\n", argv[i]);
+        return 1;
+      }
+    } else {
+      fprintf(stderr, "Unknown option %s.\n", argv[i]);
+      return 1;
+    }
+  }
+  if (options->weighted || options->engine == ENGINE_DELTA) {
+    // Only the delta-stepping engine follows the lengths of the roads, over adjacency lists in memory.
+    if (options->engine != ENGINE_COUNT && options->engine != ENGINE_DELTA) {
+      fprintf(stderr, "Weighted distances are only computed by the %s engine.\n", engine_names[ENGINE_DELTA]);
+      return 1;
+    }
+    if (options->serve || options->succinct || options->snapshot || options->shards || options->parts ||
+        options->all_distances || options->anf || options->top_closeness || options->matrix || options->budget_time ||
+        options->budget_edges) {
+      fprintf(stderr, "Weighted distances are only computed for single queries, batches and replays.\n");
+      return 1;
+    }
+    options->engine = ENGINE_DELTA;
+  }
+  if (options->cache_dir && options->weighted) {
+    fprintf(stderr, "Only the graphs whose distances are not weighted are cached.\n");
+    return 1;
+  }
+  if (options->external && (options->succinct || options->weighted)) {
+    fprintf(stderr, "The graphs built on disk are neither compressed nor weighted.\n");
+    return 1;
+  }
+  if (options->engine == ENGINE_LABELS && options->shards) {
+    fprintf(stderr, "The labels are built in this process, so they can't be used with shards.\n");
+    return 1;
+  }
+  if (options->shard_parts && (!options->shards || options->serve || options->parts || options->snapshot ||
+                               options->cache_dir || options->all_distances || options->anf ||
+                               options->top_closeness || options->matrix)) {
+    fprintf(stderr, "The parts are only loaded by the shards of single queries, batches and replays.\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+
+  options_t options;
+  if (parse_options(&options, argc, argv)) return 1;
+
+  if (options.trace) {
+    if (tracer_open(options.trace)) {
+      fprintf(stderr, "Could not create the timeline %s.\n", options.trace);
+      return 1;
+    }
+    tracer_name("process_name", getpid(), 0, options.shards ? "coordinator" : "ex2");
+    atexit(tracer_close);
+  }
+
+  slow_log_t slow_log = {NULL, options.slow_threshold};
+  if (options.slow_log && !(slow_log.file = fopen(options.slow_log, "a"))) {
+    fprintf(stderr, "Could not open the slow query log %s.\n", options.slow_log);
+    return 1;
+  }
+
+  workload_t recorder = {.file = NULL};
+  if (options.record && workload_create(&recorder, options.record)) {
+    fprintf(stderr, "Could not create the workload log %s.\n", options.record);
+    return 1;
+  }
+
+  if (options.serve) {
+    memory_phase("serve");
+    server_t server;
+    memset(&server, 0, sizeof(server_t));
+    server.slow_log = slow_log;
+    server.recorder = &recorder;
+    server.max_resident = options.max_resident;
+    server.metrics.started = now_ns();
+    server.metrics_path = options.metrics;
+    server.budget_time = options.budget_time;
+    server.budget_edges = options.budget_edges;
+    server.schedule = options.schedule;
+    server.delta_log = options.delta_log;
+    int error = 0;
+    if (options.replay) {
+      error = run_replay(&server, NULL, 0, options.replay, options.max_speed, stdout);
+      if (error) fprintf(stderr, "Could not replay the workload log %s.\n", options.replay);
+      server_close(&server);
+    } else {
+      error = serve(&server, stdin, stdout);
+    }
+    if (recorder.file) fclose(recorder.file);
+    return error;
+  }
+
+  uint64_t started = now_ns();
+  memory_phase("scan");
+  if (scan_init()) {
+    fprintf(stderr, "The input is compressed in a format which this build can't decode.\n");
+    return 1;
+  }
+
+  input_t input;
+  graph_t graph;
+  memset(&input, 0, sizeof(input_t));
+  input.weighted = options.weighted;
+  input.road_lengths = options.road_lengths;
+  input.flight_cost = options.flight_cost;
+  if (input_read_header(&input)) {
+    fprintf(stderr, "The graph has too many cities or routes for this build.\n");
+    return 1;
+  }
+  cache_t cache = {options.cache_dir, 0};
+  fingerprint_t fingerprint = {0};
+  bool cached = false;
+  struct stat status;
+  if (cache.directory && fstat(STDIN_FILENO, &status) == 0 && S_ISREG(status.st_mode)) {
+    // A regular file is identified by its metadata, so its graph is found in the cache before the file is parsed.
+    uint64_t fields[] = {1, status.st_dev, status.st_ino, status.st_size, status.st_mtim.tv_sec, status.st_mtim.tv_nsec};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) fingerprint_add(&fingerprint, fields[i]);
+    cached = cache_find(&cache, &fingerprint, options.succinct, input.cities + 1, &graph);
+  } else if (cache.directory) {
+    // Other inputs are identified by their numbers, which are hashed while they are parsed.
+    uint64_t fields[] = {2, input.cities, input.roads, input.airports_count};
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) fingerprint_add(&fingerprint, fields[i]);
+    input_fingerprint = &fingerprint;
+  }
+  build_plan_t plan = options.succinct ? BUILD_SUCCINCT : BUILD_CSR;
+  size_t peak = 0;
+  if (options.max_memory && !cached && !options.shard_parts) {
+    // The plan is chosen from the header alone, so a graph which does not fit fails before anything is allocated.
+    // The labels are kept besides the graph, so a more frugal plan is picked if it leaves room for them.
+    size_t labels_least = options.engine == ENGINE_LABELS ? labels_estimate(input.cities + 1) : 0;
+    plan = labels_least < options.max_memory
+        ? build_plan_choose(&input, options.max_memory - labels_least, options.succinct)
+        : BUILD_PLAN_COUNT;
+    if (plan == BUILD_PLAN_COUNT) plan = build_plan_choose(&input, options.max_memory, options.succinct);
+    if (plan == BUILD_PLAN_COUNT) {
+      size_t needed = build_plan_peak(options.succinct ? BUILD_SUCCINCT : BUILD_MAPPED, input.cities + 1, input.roads,
+                                      input.airports_count);
+      size_t external = build_plan_peak(BUILD_EXTERNAL, input.cities + 1, input.roads, input.airports_count);
+      if (!options.succinct && external < needed) needed = external;
+      fprintf(stderr, "The graph needs about %zu bytes of memory, but only %zu may be used.\n", needed,
+              options.max_memory);
+      return 1;
+    }
+    peak = build_plan_peak(plan, input.cities + 1, input.roads, input.airports_count);
+  }
+  if (options.external) plan = BUILD_EXTERNAL;
+  // The runs use the whole budget, since they are released before the workspace of the searches is allocated.
+  size_t run_bytes = options.max_memory > EXTERNAL_MIN_RUN_BYTES ? options.max_memory : EXTERNAL_MIN_RUN_BYTES;
+  if (!options.max_memory) run_bytes = EXTERNAL_RUN_BYTES;
+  size_t run_needed = 2 * (input.roads + input.airports_count) * sizeof(run_entry_t);
+  if (run_needed < run_bytes) run_bytes = run_needed > EXTERNAL_MIN_RUN_BYTES ? run_needed : EXTERNAL_MIN_RUN_BYTES;
+  phases_t setup = {0};
+  runs_t runs;
+  memset(&runs, 0, sizeof(runs_t));
+  FILE *staging = plan == BUILD_MAPPED ? tmpfile() : NULL;
+  int read_error = 0;
+  if (cached || options.shard_parts) {
+    // The lists of the input are not needed anymore, or the shards load their parts.
+  } else if (plan == BUILD_EXTERNAL) {
+    read_error = input_spill_runs(&input, &runs, run_bytes);
+    memory_free(runs.buffer);
+    runs.buffer = NULL;
+  } else {
+    read_error = plan == BUILD_MAPPED ? !staging || input_spill(&input, staging) : input_read_lists(&input);
+  }
+  if (read_error) {
+    fprintf(stderr, "Could not allocate the graph.\n");
+    return 1;
+  }
+  if (scan_close()) {
+    fprintf(stderr, "Could not decompress the input.\n");
+    return 1;
+  }
+  if (input_fingerprint) {
+    input_fingerprint = NULL;
+    cached = cache_find(&cache, &fingerprint, options.succinct, input.cities + 1, &graph);
+  }
+  setup.scan = now_ns() - started;
+  tracer_span("scan", getpid(), 0, started, started + setup.scan, NULL);
+
+  // A single query on a shallow graph is answered by sweeping the roads, without building the adjacency lists.
+  size_t diameter = estimate_diameter(input.cities + 1, input.roads, input.airports_count);
+  bool one_shot = !options.batch && !options.replay && !options.shards && !options.parts && !options.snapshot &&
+      !options.all_distances && !options.anf && !options.top_closeness && !options.matrix &&
+      !options.budget_time && !options.budget_edges && !options.weighted && options.engine != ENGINE_DELTA &&
+      !cache.directory && plan == BUILD_CSR;
+  bool sweep = one_shot && (options.engine == ENGINE_EDGES ||
+                            (options.engine == ENGINE_COUNT && diameter <= EDGE_SWEEPS_MAX));
+  if (cached) {
+    input_free(&input);
+    runs_free(&runs);
+    if (staging) fclose(staging);
+    if (options.snapshot && graph_save(&graph, options.snapshot)) {
+      fprintf(stderr, "Could not write the snapshot %s.\n", options.snapshot);
+      return 1;
+    }
+  } else if (options.shard_parts) {
+    // The coordinator only routes the cities between the shards, so the graph is never built here.
+    input_free(&input);
+    memset(&graph, 0, sizeof(graph_t));
+  } else if (!sweep) {
+    memory_phase("build");
+    started = now_ns();
+    int build_error;
+    if (plan == BUILD_EXTERNAL) {
+      build_error = graph_build_external(&graph, &input, &runs, options.snapshot, run_bytes);
+    } else if (plan == BUILD_MAPPED) {
+      build_error = graph_build_mapped(&graph, &input, staging, options.snapshot);
+    } else {
+      build_error = graph_build(&graph, &input);
+    }
+    if (build_error) {
+      fprintf(stderr, "Could not allocate the graph.\n");
+      return 1;
+    }
+    input_free(&input);
+    runs_free(&runs);
+    if (staging) fclose(staging);
+
+    if (plan == BUILD_SUCCINCT && graph_compress(&graph)) {
+      fprintf(stderr, "Could not compress the graph.\n");
+      return 1;
+    }
+    setup.build = now_ns() - started;
+    tracer_span("build", getpid(), 0, started, started + setup.build, NULL);
+    // A mapped or external graph is built directly in its snapshot file.
+    if (options.snapshot && !graph.mapping && graph_save(&graph, options.snapshot)) {
+      fprintf(stderr, "Could not write the snapshot %s.\n", options.snapshot);
+      return 1;
+    }
+    if (cache.directory && cache_store(&cache, &graph)) {
+      fprintf(stderr, "Could not write the graph to the cache %s.\n", cache.directory);
+    }
+  } else {
+    memset(&graph, 0, sizeof(graph_t));
+  }
+  memory_phase("solve");
+
+  if (options.parts) {
+    uint8_t *owners = (uint8_t *) malloc(graph.size * sizeof(uint8_t));
+    if (!owners) return 1;
+    if (options.ranges) {
+      partition_ranges(&graph, options.parts, owners);
+    } else {
+      if (partition_propagation(&graph, options.parts, owners)) return 1;
+    }
+    if (partition_write(&graph, options.parts, owners, options.parts_prefix)) {
+      fprintf(stderr, "Could not write the parts %s.\n", options.parts_prefix);
+      return 1;
+    }
+    size_t sizes[MAX_SHARDS] = {0};
+    for (size_t city = 1; city < graph.size; city++) sizes[owners[city]]++;
+    for (size_t part = 0; part < options.parts; part++) printf("part %zu cities %zu\n", part, sizes[part]);
+    printf("cut %zu\n", partition_cut(&graph, owners));
+    free(owners);
+    return 0;
+  }
+
+  if (options.all_distances) {
+    workspace_t workspace;
+    memset(&workspace, 0, sizeof(workspace_t));
+    int error = run_all_distances(&graph, &workspace, input.from, stdout);
+    if (error) fprintf(stderr, "Could not compute the distances.\n");
+    workspace_free(&workspace);
+    graph_free(&graph);
+    return error;
+  }
+
+  if (options.anf) {
+    int error = run_anf(&graph, options.anf_registers, options.threads, stdout);
+    if (error) fprintf(stderr, "Could not estimate the distance distribution.\n");
+    if (options.memory_report) memory_report(stderr);
+    graph_free(&graph);
+    return error;
+  }
+
+  if (options.matrix) {
+    int error = run_matrix(&graph, options.matrix, options.matrix_width, options.threads, stdout);
+    if (error) fprintf(stderr, "Could not write the distance matrix of %s.\n", options.matrix);
+    if (options.memory_report) memory_report(stderr);
+    graph_free(&graph);
+    return error;
+  }
+
+  if (options.top_closeness) {
+    workspace_t workspace;
+    memset(&workspace, 0, sizeof(workspace_t));
+    int error = cache_index_components(&cache, &graph, &workspace) ||
+        run_top_closeness(&graph, &workspace, options.top_closeness, options.threads, stdout);
+    if (error) fprintf(stderr, "Could not rank the cities.\n");
+    if (options.memory_report) memory_report(stderr);
+    workspace_free(&workspace);
+    graph_free(&graph);
+    return error;
+  }
+
+  metrics_t metrics;
+  memset(&metrics, 0, sizeof(metrics_t));
+  metrics.started = now_ns();
+  solver_t solver;
+  memset(&solver, 0, sizeof(solver_t));
+  solver.graph = &graph;
+  solver.metrics = &metrics;
+  solver.slow_log = &slow_log;
+  solver.setup = setup;
+  solver.recorder = &recorder;
+  solver.budget_time = options.budget_time;
+  solver.budget_edges = options.budget_edges;
+  if (sweep) {
+    solver.engine = ENGINE_EDGES;
+    solver.input = &input;
+    // A forced engine never gives up, and an estimated diameter is trusted up to twice its value.
+    solver.max_sweeps = options.engine == ENGINE_EDGES ? SIZE_MAX : 2 * diameter;
+  }
+  if (options.engine == ENGINE_DELTA) {
+    if (delta_search_init(&solver.delta, &graph, options.threads, options.delta)) {
+      fprintf(stderr, "Could not allocate the buckets.\n");
+      return 1;
+    }
+    solver.engine = ENGINE_DELTA;
+  }
+  if (options.engine == ENGINE_LABELS) {
+    uint64_t before = now_ns();
+    // Under a memory budget, the labels may only grow in what the graph leaves, and the searches are used otherwise.
+    size_t left = options.max_memory > peak ? options.max_memory - peak : 0;
+    size_t least = labels_estimate(graph.size);
+    size_t max_entries = options.max_memory && left >= least ? graph.size + (left - least) / sizeof(label_t) : 0;
+    if (options.max_memory && !max_entries) {
+      fprintf(stderr, "The labels need more than the %zu bytes of memory which are left, so searches are used.\n", left);
+    } else if (cache_labels_build(&cache, &solver.labels, &graph, max_entries)) {
+      if (!options.max_memory) {
+        fprintf(stderr, "Could not allocate the labels.\n");
+        return 1;
+      }
+      fprintf(stderr, "The labels need more than the %zu bytes of memory which are left, so searches are used.\n", left);
+    } else {
+      tracer_span("label", getpid(), 0, before, now_ns(), NULL);
+      solver.engine = ENGINE_LABELS;
+    }
+  }
+  size_t size = options.shard_parts ? input.cities + 1 : graph.size;
+  bool index_fits = !options.max_memory || peak + graph.size * sizeof(int) <= options.max_memory;
+  if (options.batch && !options.shards && (options.budget_time || options.budget_edges) && index_fits) {
+    // The distances to the hub take a full search to compute, which only pays off over many queries.
+    if (cache_index_hub(&cache, &graph, &solver.workspace)) {
+      fprintf(stderr, "Could not allocate the graph.\n");
+      return 1;
+    }
+  }
+  if (options.shards) {
+    const char *prefix = options.shard_parts;
+    char directory[] = "/tmp/ex2-parts-XXXXXX";
+    char temporary[sizeof(directory) + 8];
+    if (!prefix) {
+      // The graph is split here, and released before the shards load their parts, like they would with --parts.
+      uint8_t *owners = (uint8_t *) malloc(graph.size * sizeof(uint8_t));
+      if (!owners) return 1;
+      if (options.ranges) {
+        partition_ranges(&graph, options.shards, owners);
+      } else {
+        if (partition_propagation(&graph, options.shards, owners)) return 1;
+      }
+      int error = !mkdtemp(directory);
+      if (!error) {
+        snprintf(temporary, sizeof(temporary), "%s/part", directory);
+        error = partition_write(&graph, options.shards, owners, temporary);
+      }
+      free(owners);
+      if (error) {
+        fprintf(stderr, "Could not write the parts of the shards.\n");
+        return 1;
+      }
+      prefix = temporary;
+    }
+    graph_free(&graph);
+    int error = shard_pool_start(&solver.pool, prefix, options.shards, size);
+    if (!options.shard_parts) {
+      // The shards keep their part open, so the files can be removed right away.
+      char path[sizeof(temporary) + 24];
+      for (size_t i = 0; i < options.shards; i++) {
+        snprintf(path, sizeof(path), "%s.%zu", temporary, i);
+        unlink(path);
+      }
+      rmdir(directory);
+    }
+    if (error) {
+      fprintf(stderr, "Could not start the shards from the parts %s.\n", prefix);
+      return 1;
+    }
+    solver.engine = ENGINE_SHARDED;
+  }
+
+  int error = 0;
+  if (options.replay) {
+    error = run_replay(NULL, &solver, size, options.replay, options.max_speed, stdout);
+    if (error) fprintf(stderr, "Could not replay the workload log %s.\n", options.replay);
+  } else if (options.batch) {
+    error = run_batch(&solver, size, options.batch, stdout);
+    if (error) fprintf(stderr, "Could not answer the queries of %s.\n", options.batch);
+  } else {
+    int result;
+    error = solver_query(&solver, input.from, input.until, &result);
+    if (error) {
+      // The edge-centric engine only fails when it builds the graph it gave up on.
+      fprintf(stderr, solver.engine == ENGINE_EDGES ? "Could not allocate the graph.\n"
+                                                    : "Could not start the workers of the search.\n");
+    } else {
+      print_result(stdout, result, &solver.workspace.bounds);
+    }
+  }
+  if (options.memory_report) memory_report(stderr);
+  solver_free(&solver);
+  input_free(&input);
+  if (options.metrics && metrics_export(&metrics, options.metrics)) {
+    fprintf(stderr, "Could not export the metrics to %s.\n", options.metrics);
+    error = 1;
+  }
+  if (slow_log.file) fclose(slow_log.file);
+  if (recorder.file) fclose(recorder.file);
+  return error;
+}
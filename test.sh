@@ -14,4 +14,96 @@ diff -u ./data/02.a <(cat ./data/02 | ./build/ex2)
 diff -u ./data/03.a <(cat ./data/03 | ./build/ex2)
 diff -u ./data/04.a <(cat ./data/04 | ./build/ex2)
 diff -u ./data/05.a <(cat ./data/05 | ./build/ex2)
+diff -u ./data/01.a <(cat ./data/01 | ./build/ex2 --succinct)
+diff -u ./data/02.a <(cat ./data/02 | ./build/ex2 --succinct)
+diff -u ./data/03.a <(cat ./data/03 | ./build/ex2 --succinct)
+diff -u ./data/04.a <(cat ./data/04 | ./build/ex2 --succinct)
+diff -u ./data/05.a <(cat ./data/05 | ./build/ex2 --succinct)
+# The graphs are built within the smallest budget which the program reports, since it depends on the width of cities.
+for test in 01 02 03 04 05; do
+  budget=$(cat ./data/$test | ./build/ex2 --max-memory 1 2>&1 > /dev/null | grep -o "needs about [0-9]*" | grep -o "[0-9]*$")
+  diff -u ./data/$test.a <(cat ./data/$test | ./build/ex2 --max-memory "$budget")
+done
+diff -u ./data/01.a <(cat ./data/01 | ./build/ex2 --external)
+diff -u ./data/02.a <(cat ./data/02 | ./build/ex2 --external)
+diff -u ./data/03.a <(cat ./data/03 | ./build/ex2 --external)
+diff -u ./data/04.a <(cat ./data/04 | ./build/ex2 --external)
+diff -u ./data/05.a <(cat ./data/05 | ./build/ex2 --external)
+diff -u ./data/05.a <(gzip -c ./data/05 | ./build/ex2)
+diff -u ./data/batch.a <(cat ./data/01 | ./build/ex2 --batch ./data/batch)
+diff -u ./data/budget.a <(cat ./data/01 | ./build/ex2 --batch ./data/batch --budget-edges 2)
+# The queries of a batch are recorded as they were read, and replaying them gives the same answers.
+cat ./data/01 | ./build/ex2 --batch ./data/batch --record ./build/batch.workload > /dev/null
+diff -u <(echo "replayed 5 queries") <(cat ./data/01 | ./build/ex2 --replay ./build/batch.workload --max-speed \
+  --slow-log ./build/replay.slow --slow-threshold-us 0 | grep -o "replayed [0-9]* queries")
+diff -u <(paste -d ' ' ./data/batch ./data/batch.a) \
+  <(sed -E 's/.*from=([0-9]*) until=([0-9]*) result=([^ ]*).*/\1 \2 \3/' ./build/replay.slow)
+diff -u ./data/all.a <(cat ./data/01 | ./build/ex2 --all-distances)
+diff -u ./data/anf.a <(cat ./data/01 | ./build/ex2 --anf --threads 2)
+diff -u ./data/closeness.a <(cat ./data/01 | ./build/ex2 --top-closeness 3 --threads 2)
+diff -u ./data/matrix.a <(cat ./data/01 | ./build/ex2 --matrix ./data/matrix --matrix-width 16 | od -An -v -td2 -w10)
+diff -u ./data/weighted.a <(cat ./data/weighted | ./build/ex2 --weighted --flight-cost 4 --threads 2)
+# The slow log keeps the fields of each query which don't depend on its timing.
+cat ./data/01 | ./build/ex2 --slow-log ./build/slow.log --slow-threshold-us 0 > /dev/null
+cat ./data/02 | ./build/ex2 --engine bfs --slow-log ./build/slow.log --slow-threshold-us 0 > /dev/null
+cat ./data/01 | ./build/ex2 --batch ./data/batch --budget-edges 2 --slow-log ./build/slow.log --slow-threshold-us 0 > /dev/null
+cat ./data/01 | ./build/ex2 --batch ./data/batch --slow-log ./build/slow.log --slow-threshold-us 0 > /dev/null
+cat ./data/weighted | ./build/ex2 --weighted --flight-cost 4 --slow-log ./build/slow.log --slow-threshold-us 0 > /dev/null
+diff -u ./data/slow.a <(sed -E 's/ [a-z]+_us=[0-9]+//g' ./build/slow.log)
+# The timeline has the same events for the same queries, once their processes and times are removed.
+cat ./data/01 | ./build/ex2 --engine bfs --trace ./build/bfs.trace > /dev/null
+cat ./data/01 | ./build/ex2 --shards 2 --trace ./build/shards.trace > /dev/null
+diff -u ./data/trace.a <(sed -E 's/"pid":[0-9]+,//; s/,"ts":[0-9.]+,"dur":[0-9.]+//' ./build/bfs.trace ./build/shards.trace)
+# Each query of a batch has its span, including the queries which are answered by the search of their group.
+cat ./data/01 | ./build/ex2 --batch ./data/batch --trace ./build/batch.trace > /dev/null
+diff -u <(wc -l < ./data/batch) <(grep -c '"name":"query"' ./build/batch.trace)
+# The memory report lists every structure and phase, and the total in use is the sum of the structures.
+cat ./data/01 | ./build/ex2 --engine bfs --memory-report 2> ./build/memory.report > /dev/null
+diff -u ./data/memory.a <(sed -E 's/ [0-9]+//g' ./build/memory.report)
+diff -u <(echo "consistent") <(awk '$1 == "memory" && $4 > $6 { wrong = 1 }
+  $1 == "memory" && $2 != "total" { sum += $4 } $1 == "memory" && $2 == "total" { total = $4 }
+  END { print (sum == total && total > 0 && !wrong) ? "consistent" : "inconsistent" }' ./build/memory.report)
+# Both workers of the delta-stepping engine relax roads of the cities they own.
+cat ./data/weighted | ./build/ex2 --weighted --flight-cost 4 --threads 2 --trace ./build/weighted.trace > /dev/null
+diff -u <(echo 2) <(grep -o '"delta worker"[^}]*"relaxed":[1-9]' ./build/weighted.trace | wc -l)
+for shards in 2 3 8; do
+  diff -u ./data/01.a <(cat ./data/01 | ./build/ex2 --shards $shards)
+  diff -u ./data/02.a <(cat ./data/02 | ./build/ex2 --shards $shards)
+  diff -u ./data/03.a <(cat ./data/03 | ./build/ex2 --shards $shards)
+  diff -u ./data/04.a <(cat ./data/04 | ./build/ex2 --shards $shards)
+  diff -u ./data/05.a <(cat ./data/05 | ./build/ex2 --shards $shards)
+  diff -u ./data/batch.a <(cat ./data/01 | ./build/ex2 --shards $shards --batch ./data/batch)
+done
+mkdir -p ./build/cache
+for run in 1 2; do
+  diff -u ./data/01.a <(cat ./data/01 | ./build/ex2 --cache-dir ./build/cache)
+  diff -u ./data/budget.a <(./build/ex2 --cache-dir ./build/cache --batch ./data/batch --budget-edges 2 < ./data/01)
+  diff -u ./data/closeness.a <(./build/ex2 --cache-dir ./build/cache --top-closeness 3 < ./data/01)
+done
+diff -u ./data/partition.a <(cat ./data/01 | ./build/ex2 --partition 2 ./build/01)
+# The shards load the parts written above, and the coordinator never builds the graph.
+diff -u ./data/01.a <(cat ./data/01 | ./build/ex2 --shards 2 --parts ./build/01)
+diff -u ./data/batch.a <(cat ./data/01 | ./build/ex2 --batch ./data/batch --shards 2 --parts ./build/01)
+diff -u <(echo "memory neighbours current 0 peak 0") \
+  <(cat ./data/01 | ./build/ex2 --shards 2 --parts ./build/01 --memory-report 2>&1 > /dev/null | grep "memory neighbours")
+./build/ex2 --snapshot ./build/01.snap < ./data/01 > /dev/null
+./build/ex2 --succinct --snapshot ./build/02.snap < ./data/02 > /dev/null
+./build/ex2 --snapshot ./build/03.snap < ./data/03 > /dev/null
+./build/ex2 --external --snapshot ./build/03.external.snap < ./data/03 > /dev/null
+cmp ./build/03.snap ./build/03.external.snap
+diff -u ./data/serve.a <(cat ./data/serve | ./build/ex2 --serve --max-resident 1K)
+diff -u ./data/schedule.a <(cat ./data/serve | ./build/ex2 --serve --schedule | sort)
+# The scheduled queries of graphs which are not loaded don't evict each other's graphs, so each graph is loaded once.
+diff -u ./data/resident.a <(cat ./data/resident | ./build/ex2 --serve --schedule --max-resident 1 | grep "^graph" |
+  sed -E 's/ bytes [0-9]+//')
+diff -u ./data/labels.a <(cat ./data/labels | ./build/ex2 --serve)
+diff -u ./data/03.a <(cat ./data/03 | ./build/ex2 --engine labels --max-memory 1K)
+cp ./build/01.snap ./build/delta.snap
+diff -u ./data/delta.a <(cat ./data/delta | ./build/ex2 --serve --delta-log)
+diff -u ./data/restart.a <(cat ./data/restart | ./build/ex2 --serve --delta-log)
+# The roads added to a served graph are recorded and added again by the replay, and the searches count their edges.
+cp ./build/01.snap ./build/roads.snap
+cat ./data/roads | ./build/ex2 --serve --record ./build/roads.workload > /dev/null
+./build/ex2 --serve --replay ./build/roads.workload --max-speed --slow-log ./build/roads.slow --slow-threshold-us 0 > /dev/null
+diff -u ./data/roads.a <(sed -E 's/.*(from=.* result=[^ ]*).*( edges=[0-9]*).*/\1\2/' ./build/roads.slow)
 echo "--- DONE ! ---"